@@ -3,57 +3,116 @@
 #include <stdbool.h>
 #include <string.h>
 #include <time.h>
+#include <math.h>
+#include <stdint.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "benchmark.h"
 #include "qsort.h"
+#include "sort_dispatch.h"
+#include "perf_counters.h"
+#include "prng.h"
+#include "sort_i32.h"
+
+#ifndef min
+#define min(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
 /*
 Sorting Benchmark
 Array Patterns:
-sorted, unsorted(random), mostly sorted, reversed, mostly reversed, killer
-Data Type:
-int(0), char(1), string(2), struct
+sorted, unsorted(random), mostly sorted, reversed, mostly reversed, killer,
+dual pivot killer, zipf, few unique, all equal, sawtooth, organ pipe,
+random runs, push front, push back, gaussian, sorted with random tail,
+antiqsort (McIlroy's adversary against the routine under test)
+Data Types:
+int, char, string, double, in high and low cardinality, and records of a key and
+a 16 to 256 byte payload, chosen at run time
 */
 
-/* compare functions, used for qsort */
-int cmp(const void *a, const void *b) {
-#ifdef STR_GEN
-	return strcmp(*((SORT_TYPE*)a), *((SORT_TYPE*)b));
-#else
-	return *((SORT_TYPE*)a) - *((SORT_TYPE*)b);
-#endif
-}
-int cmp_reverse(const void *a, const void *b) {
-#ifdef STR_GEN
-	return strcmp(*((SORT_TYPE*)b), *((SORT_TYPE*)a));
+#ifdef COUNT_COMPARISONS
+#include <stdatomic.h>
+
+/* number of calls to cmp since the last reset, from any thread */
+static atomic_ullong comparisons;
+
+#define count_comparison() atomic_fetch_add_explicit(&comparisons, 1, memory_order_relaxed)
 #else
-	return *((SORT_TYPE*)b) - *((SORT_TYPE*)a);
+#define count_comparison() ((void)0)
 #endif
-}
 
-/* Only tested using Visual C++ 14.1 on Windows, where RAND_MAX is 0x7fff
-Bit shifting is needed to generate random integer larger than RAND_MAX
-*/
-static int random_int(int max) {
-	static bool init = false;
-	if (!init) {
-		srand((unsigned)time(NULL));
-		init = true;
+/* selection of the current test() call */
+static const BenchFilter *filter;
+
+const char *const bench_pages_names[] = { "default", "small", "thp", "hugetlb" };
+
+enum BenchPages bench_pages = PAGES_DEFAULT;
+
+bool bench_export_text = false;
+
+unsigned long long bench_seed = SEED;
+
+const char *const pattern_names[PATTERNS] = { "sorted", "unsorted", "reversed", "mostly-sorted", "mostly-reversed",
+	"killer", "dual-pivot-killer", "zipf", "few-unique", "all-equal", "sawtooth", "organ-pipe", "random-runs",
+	"push-front", "push-back", "gaussian", "sorted-tail", "antiqsort" };
+
+double pattern_params[PATTERNS] = {
+	[ZIPF] = 1.0,
+	[FEW_UNIQUE] = 16,
+	[SAWTOOTH] = 16,
+	[ORGAN_PIPE] = 1,
+	[RANDOM_RUNS] = 1000,
+	[PUSH_FRONT] = 1,
+	[PUSH_BACK] = 1,
+	[GAUSSIAN] = 0.1,
+	[SORTED_TAIL] = 0.1,
+};
+
+bool setPatternParam(const char *assignment) {
+	const char *value = strchr(assignment, '=');
+
+	if (!value) {
+		return false;
 	}
-	long long num = rand();
-	if (RAND_MAX < max) {
-		num = (num << 16) + rand();
+	for (int p = 0; p < PATTERNS; p++) {
+		if (strlen(pattern_names[p]) == (size_t)(value - assignment) &&
+			!strncmp(assignment, pattern_names[p], value - assignment)) {
+			pattern_params[p] = strtod(value + 1, NULL);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool checkSizes(const char *list) {
+	for (const char *s = list; ; s++) {
+		char *end;
+		long n = strtol(s, &end, 10);
+
+		if (end == s || n < 1 || n > INT_MAX || (*end && *end != ',')) {
+			return false;
+		}
+		s = strchr(s, ',');
+		if (!s) {
+			return true;
+		}
 	}
-	return num % max;
 }
 
 /* generate random string */
-static char *rand_string(char *str, size_t size){
+static char *rand_string(char *str, size_t size, PRNG *rng){
 	const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 	if (size) {
 		--size;
 		for (size_t n = 0; n < size; n++) {
-			int key = rand() % (int)(sizeof charset - 1);
+			int key = prngBelow(rng, (uint32_t)(sizeof charset - 1));
 			str[n] = charset[key];
 		}
 		str[size] = '\0';
@@ -61,54 +120,212 @@ static char *rand_string(char *str, size_t size){
 	return str;
 }
 
-static char *get_max_str(char *str, size_t size) {
-	for (int i = 0; i < size; i++) {
-		str[i] = 'z' + 1;
+/* compare functions, order is used to generate and verify, cmp by the engines */
+static int int_order(const void *a, const void *b) {
+	return *(const int*)a - *(const int*)b;
+}
+static int int_cmp(const void *a, const void *b) {
+	count_comparison();
+	return int_order(a, b);
+}
+static void int_random(void *e, const BenchType *type, PRNG *rng) {
+	*(int*)e = prngBelow(rng, type->max);
+}
+static void int_write(FILE *f, const void *e) {
+	fprintf(f, "%d ", *(const int*)e);
+}
+
+static int char_order(const void *a, const void *b) {
+	return *(const char*)a - *(const char*)b;
+}
+static int char_cmp(const void *a, const void *b) {
+	count_comparison();
+	return char_order(a, b);
+}
+static void char_random(void *e, const BenchType *type, PRNG *rng) {
+	*(char*)e = prngBelow(rng, type->max);
+}
+static void char_write(FILE *f, const void *e) {
+	fprintf(f, "%d ", *(const char*)e);
+}
+
+static int string_order(const void *a, const void *b) {
+	return strcmp(*(char *const*)a, *(char *const*)b);
+}
+static int string_cmp(const void *a, const void *b) {
+	count_comparison();
+	return string_order(a, b);
+}
+static void string_random(void *e, const BenchType *type, PRNG *rng) {
+	char *str = malloc(sizeof(char)*type->max);
+	*(char**)e = rand_string(str, type->max, rng);
+}
+static void string_write(FILE *f, const void *e) {
+	fprintf(f, "%s ", *(char *const*)e);
+}
+static void string_release(void *e) {
+	free(*(char**)e);
+}
+
+static int double_order(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+static int double_cmp(const void *a, const void *b) {
+	count_comparison();
+	return double_order(a, b);
+}
+static void double_random(void *e, const BenchType *type, PRNG *rng) {
+	*(double*)e = (double)prngBelow(rng, type->max);
+}
+static void double_write(FILE *f, const void *e) {
+	fprintf(f, "%lf ", *(const double*)e);
+}
+
+/*
+records are a long long key, like the datum1 of a SortTuple, followed by a payload
+derived from the key, so that verification notices an element moved in pieces
+*/
+static unsigned char record_byte(long long key, size_t i) {
+	return (unsigned char)((unsigned long long)key >> (8 * (i % sizeof(key))) ^ i);
+}
+static int record_order(const void *a, const void *b) {
+	long long x = *(const long long*)a, y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+static int record_cmp(const void *a, const void *b) {
+	count_comparison();
+	return record_order(a, b);
+}
+static void record_random(void *e, const BenchType *type, PRNG *rng) {
+	long long key = prngBelow(rng, type->max);
+	unsigned char *payload = (unsigned char*)e + sizeof(key);
+
+	*(long long*)e = key;
+	for (size_t i = 0; i < type->es - sizeof(key); i++) {
+		payload[i] = record_byte(key, i);
 	}
-	str[size] = '\0';
-	return str;
+}
+static void record_write(FILE *f, const void *e) {
+	fprintf(f, "%lld ", *(const long long*)e);
+}
+static bool record_intact(const void *e, const BenchType *type) {
+	long long key = *(const long long*)e;
+	const unsigned char *payload = (const unsigned char*)e + sizeof(key);
+
+	for (size_t i = 0; i < type->es - sizeof(key); i++) {
+		if (payload[i] != record_byte(key, i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#define INT_TYPE false, int_cmp, int_order, int_random, int_write, NULL, NULL
+#define CHAR_TYPE false, char_cmp, char_order, char_random, char_write, NULL, NULL
+#define STRING_TYPE true, string_cmp, string_order, string_random, string_write, string_release, NULL
+#define DOUBLE_TYPE false, double_cmp, double_order, double_random, double_write, NULL, NULL
+#define RECORD_TYPE false, record_cmp, record_order, record_random, record_write, NULL, record_intact
+
+const BenchType bench_types[BENCH_TYPES] = {
+	// high cardinality int
+	{ "int", sizeof(int), 1000000000, true, INT_TYPE },
+	// characters
+	{ "char", sizeof(char), 256, true, CHAR_TYPE },
+	// high cardinality string
+	{ "string", sizeof(char*), 10, false, STRING_TYPE },
+	// high cardinality double
+	{ "double", sizeof(double), 100000000, false, DOUBLE_TYPE },
+	// low cardinality int
+	{ "int-low", sizeof(int), 10000, true, INT_TYPE },
+	// low cardinality string
+	{ "string-low", sizeof(char*), 2, false, STRING_TYPE },
+	// low cardinality double
+	{ "double-low", sizeof(double), 10000, false, DOUBLE_TYPE },
+	// records with a high cardinality key and a 16 to 256 byte payload
+	{ "record16", sizeof(long long) + 16, 1000000000, false, RECORD_TYPE },
+	{ "record32", sizeof(long long) + 32, 1000000000, false, RECORD_TYPE },
+	{ "record64", sizeof(long long) + 64, 1000000000, false, RECORD_TYPE },
+	{ "record128", sizeof(long long) + 128, 1000000000, false, RECORD_TYPE },
+	{ "record256", sizeof(long long) + 256, 1000000000, false, RECORD_TYPE },
+};
+
+/* type the data is generated for, for cmp_reverse */
+static const BenchType *generating;
+
+static int cmp_reverse(const void *a, const void *b) {
+	return generating->order(b, a);
 }
 
-/* concat file name based on type, array pattern and size */
-static void makeFileName(char* output, enum Pattern pattern, int size) {
-	sprintf(output, "td_%d_%d_%d.txt", TYPE_CODE, pattern, size);
+/* concat file name based on type, array pattern, size and format */
+static void makeFileName(char* output, const BenchType *type, enum Pattern pattern, int size, const char *ext) {
+	sprintf(output, "td_%d_%d_%d.%s", (int)(type - bench_types), pattern, size, ext);
 }
 
 /* swap block of data, tmp is an array passed in by the caller
 to store temparary data.
 */
-static void swapBlock(SORT_TYPE* a, SORT_TYPE* b, int len, SORT_TYPE* tmp) {
-	int size = len * sizeof(SORT_TYPE);
+static void swapBlock(char* a, char* b, size_t size, char* tmp) {
 	memcpy(tmp, a, size);
 	memcpy(a, b, size);
 	memcpy(b, tmp, size);
 }
 
-/* shuffle an array using bins of size binLen
+/* shuffle an array of size elements of es bytes using bins of binLen elements
 used to create mostly sorted and mostly reversed arrays
-binLen must divide size
+when binLen does not divide size the shorter last bin goes to a random bin boundary
 */
-static void shuffleArray(SORT_TYPE* a, int size, int binLen) {
-	SORT_TYPE* tmp = (SORT_TYPE*)malloc(sizeof(SORT_TYPE)*binLen);
-	for (int i = size / binLen - 1; i > 0; i--) {
+static void shuffleArray(char* a, int size, size_t es, int binLen, PRNG *rng) {
+	if (binLen < 1) {
+		binLen = 1;
+	}
+	int bins = size / binLen;
+	size_t binSize = binLen * es;
+	size_t tail = (size_t)(size - bins * binLen) * es;
+	char* tmp = (char*)malloc(binSize);
+	for (int i = bins - 1; i > 0; i--) {
 		// Pick a random index from 0 to i
-		int j = random_int(i + 1);
+		int j = prngBelow(rng, i + 1);
 		// Swap arr[i] with the element at random index
 		if (i != j) {
-			swapBlock(&a[i*binLen], &a[j*binLen], binLen, tmp);
+			swapBlock(a + i*binSize, a + j*binSize, binSize, tmp);
 		}
 	}
+	if (tail) {
+		char *to = a + prngBelow(rng, bins + 1) * binSize;
+		char *end = a + bins * binSize;
+		memcpy(tmp, end, tail);
+		memmove(to + tail, to, end - to);
+		memcpy(to, tmp, tail);
+	}
 	free(tmp);
 }
 
-/* generate qsort killer sequence using a sorted array */
+/* generate qsort killer sequence using a sorted array
+val is the index of the element's value in the sorted array, or PLACEHOLDER
+while no value was given to it yet
+*/
 struct SORT_TYPE_WITH_POS {
-	SORT_TYPE val;
+	int val;
 	int pos;
 };
 
 typedef struct SORT_TYPE_WITH_POS SORT_POS;
 
+#define PLACEHOLDER -1
+
+/* sorted array the killer values are taken from, and its type */
+static const char *killer_sorted;
+static const BenchType *killer_type;
+
+/* compare function for SORT_POS, placeholders are larger than any value */
+static int cmpPos(const SORT_POS *a, const SORT_POS *b) {
+	if (a->val == PLACEHOLDER || b->val == PLACEHOLDER) {
+		return (a->val == PLACEHOLDER) - (b->val == PLACEHOLDER);
+	}
+	return killer_type->order(killer_sorted + a->val * killer_type->es, killer_sorted + b->val * killer_type->es);
+}
+
 /* swap function for SORT_POS */
 void swapPos(SORT_POS* a, SORT_POS* b) {
 	SORT_POS c = *b;
@@ -125,31 +342,19 @@ void swapPosVec(SORT_POS* a, SORT_POS* b, int n) {
 	return;
 }
 
-static SORT_TYPE upperBound() {
-#ifdef INT_GEN
-	return MAX_INT;
-#elif defined STR_GEN
-	static char str[MAX_STR_LEN + 1];
-	return get_max_str(str, MAX_STR_LEN);
-#elif defined DOU_GEN
-	return (double)MAX_INT;
-#endif
-}
-
-static int safeSet(SORT_POS* a, int i, SORT_TYPE val) {
-	if (a[i].val == upperBound()) {
+static int safeSet(SORT_POS* a, int i, int val) {
+	if (a[i].val == PLACEHOLDER) {
 		a[i].val = val;
 		return 1;
 	}
 	return 0;
 }
-static void generate_killer_recursive(SORT_POS *a, SORT_TYPE* sorted, size_t n, int* pmin, int* pmax)
+static void generate_killer_recursive(SORT_POS *a, size_t n, int* pmin, int* pmax)
 {
 	SORT_POS	   *pa,
 		*pb,
 		*pc,
 		*pd,
-		*pl,
 		*pm,
 		*pn;
 	size_t		d1,
@@ -160,23 +365,22 @@ loop:
 	if (n < 7)
 	{
 		for (int i = 0; i < n; i++) {
-			if (safeSet(a, i, sorted[*pmax])) {
+			if (safeSet(a, i, *pmax)) {
 				*pmax -= 1;
-			}	
+			}
 		}
 		return;
 	}
 	pm = a + (n / 2);
 	if (n > 7)
 	{
-		pl = a;
 		pn = a + (n - 1);
 		if (n > 40)
 		{
 			size_t d = (n / 8);
 			int indexes[] = { 0,d,2 * d,pm - a - d,pm - a,pm - a + d,pn - a - 2 * d,pn - a - d,pn - a };
 			for (int i = 0; i < 9; i++) {
-				if (safeSet(a, indexes[i], sorted[*pmin])) {
+				if (safeSet(a, indexes[i], *pmin)) {
 					*pmin += 1;
 				}
 			}
@@ -184,7 +388,7 @@ loop:
 		else {
 			int indexes[] = { 0,pm - a,pn - a };
 			for (int i = 0; i < 3; i++) {
-				if (safeSet(a, indexes[i], sorted[*pmin])) {
+				if (safeSet(a, indexes[i], *pmin)) {
 					*pmin += 1;
 				}
 			}
@@ -195,7 +399,7 @@ loop:
 	pc = pd = a + (n - 1);
 	for (;;)
 	{
-		while (pb <= pc && (r = cmp(pb, a)) <= 0)
+		while (pb <= pc && (r = cmpPos(pb, a)) <= 0)
 		{
 			if (r == 0)
 			{
@@ -204,7 +408,7 @@ loop:
 			}
 			pb ++;
 		}
-		while (pb <= pc && (r = cmp(pc, a)) >= 0)
+		while (pb <= pc && (r = cmpPos(pc, a)) >= 0)
 		{
 			if (r == 0)
 			{
@@ -230,7 +434,7 @@ loop:
 	{
 		/* Recurse on left partition, then iterate on right partition */
 		if (d1 > 1)
-			generate_killer_recursive(a, sorted, d1, pmin, pmax);
+			generate_killer_recursive(a, d1, pmin, pmax);
 		if (d2 > 1)
 		{
 			a = pn - d2;
@@ -242,7 +446,7 @@ loop:
 	{
 		/* Recurse on right partition, then iterate on left partition */
 		if (d2 > 1)
-			generate_killer_recursive(pn - d2, sorted, d2, pmin, pmax);
+			generate_killer_recursive(pn - d2, d2, pmin, pmax);
 		if (d1 > 1)
 		{
 			n = d1;
@@ -251,200 +455,1170 @@ loop:
 	}
 }
 
-static void generateMedKiller(SORT_TYPE* a,  int size) {
-	int imin = 0, imax = size - 1;
+/* placeholders for the killer sequence of a sorted array of size elements */
+static SORT_POS* killerStart(char* a, const BenchType *type, int size) {
 	SORT_POS* tmp = (SORT_POS*)malloc(sizeof(SORT_POS)*size);
+	char* sorted = (char*)malloc(size * type->es);
+	memcpy(sorted, a, size * type->es);
 	for (int i = 0; i < size; i++) {
 		tmp[i].pos = i;
-		tmp[i].val = upperBound();
+		tmp[i].val = PLACEHOLDER;
 	}
-	generate_killer_recursive(tmp, a, size, &imin, &imax);
+	killer_sorted = sorted;
+	killer_type = type;
+	return tmp;
+}
+
+/* move the values to the positions the killer sequence gave them */
+static void killerFinish(char* a, SORT_POS* tmp, int size) {
+	size_t es = killer_type->es;
 	for (int i = 0; i < size; i++) {
-		if (imax <= imin) {
+		memcpy(a + tmp[i].pos * es, killer_sorted + tmp[i].val * es, es);
+	}
+	free((void*)killer_sorted);
+	free(tmp);
+}
+
+static void generateMedKiller(char* a, const BenchType *type, int size) {
+	int imin = 0, imax = size - 1;
+	SORT_POS* tmp = killerStart(a, type, size);
+	generate_killer_recursive(tmp, size, &imin, &imax);
+	for (int i = 0; i < size; i++) {
+		if (imax < imin) {
 			break;
 		}
-		if (safeSet(tmp, i, a[imax])) {
+		if (safeSet(tmp, i, imax)) {
 			imax -= 1;
 		}
 	}
+	killerFinish(a, tmp, size);
+	return;
+}
+
+/* generate dual pivot quick sort killer sequence using a sorted array.
+The partitioning of dual_pivot_quick_sort is replayed on placeholders,
+and the five sample elements of each range are given the smallest values
+not yet used, so both pivots land at the low end and nearly the whole
+range is passed on to the right part.
+*/
+static void generateDualPivotKiller(char* a, const BenchType *type, int size) {
+	int imin = 0;
+	SORT_POS* tmp = killerStart(a, type, size);
+	size_t left = 0, right = size - 1;
+	while (size > 0 && right - left + 1 >= INSERTION_THRESHOLD) {
+		size_t length = right - left + 1;
+		size_t seventh = (length >> 3) + (length >> 6) + 1;
+		size_t e[5];
+		e[2] = (left + right) >> 1;
+		e[1] = e[2] - seventh;
+		e[0] = e[1] - seventh;
+		e[3] = e[2] + seventh;
+		e[4] = e[3] + seventh;
+		for (int i = 0; i < 5; i++) {
+			if (safeSet(tmp, e[i], imin)) {
+				imin += 1;
+			}
+		}
+
+		// Sort the sample the way the partitioning does
+		for (int i = 1; i < 5; i++) {
+			SORT_POS t = tmp[e[i]];
+			int j = i;
+			for (; j > 0 && cmpPos(&t, &tmp[e[j - 1]]) < 0; j--) {
+				tmp[e[j]] = tmp[e[j - 1]];
+			}
+			tmp[e[j]] = t;
+		}
+
+		size_t less = left, great = right;
+		if (cmpPos(&tmp[e[0]], &tmp[e[1]]) && cmpPos(&tmp[e[1]], &tmp[e[2]]) &&
+			cmpPos(&tmp[e[2]], &tmp[e[3]]) && cmpPos(&tmp[e[3]], &tmp[e[4]])) {
+			SORT_POS pivot1 = tmp[e[1]], pivot2 = tmp[e[3]];
+			tmp[e[1]] = tmp[left];
+			tmp[e[3]] = tmp[right];
+			do { ++less; } while (cmpPos(&tmp[less], &pivot1) < 0);
+			do { --great; } while (cmpPos(&tmp[great], &pivot2) > 0);
+			for (size_t k = less; k <= great; k++) {
+				SORT_POS ak = tmp[k];
+				if (cmpPos(&ak, &pivot1) < 0) {
+					tmp[k] = tmp[less];
+					tmp[less] = ak;
+					++less;
+				}
+				else if (cmpPos(&ak, &pivot2) > 0) {
+					while (cmpPos(&tmp[great], &pivot2) > 0) {
+						if (great-- == k) {
+							goto done;
+						}
+					}
+					if (cmpPos(&tmp[great], &pivot1) < 0) {
+						tmp[k] = tmp[less];
+						tmp[less] = tmp[great];
+						++less;
+					}
+					else {
+						tmp[k] = tmp[great];
+					}
+					tmp[great] = ak;
+					--great;
+				}
+			}
+		done:
+			tmp[left] = tmp[less - 1]; tmp[less - 1] = pivot1;
+			tmp[right] = tmp[great + 1]; tmp[great + 1] = pivot2;
+			// Placeholders are larger than both pivots, keep chasing them
+			left = great + 2;
+		}
+		else {
+			SORT_POS pivot = tmp[e[2]];
+			for (size_t k = less; k <= great; k++) {
+				if (!cmpPos(&tmp[k], &pivot)) {
+					continue;
+				}
+				SORT_POS ak = tmp[k];
+				if (cmpPos(&ak, &pivot) < 0) {
+					tmp[k] = tmp[less];
+					tmp[less] = ak;
+					++less;
+				}
+				else {
+					while (cmpPos(&tmp[great], &pivot) > 0) {
+						--great;
+					}
+					if (cmpPos(&tmp[great], &pivot) < 0) {
+						tmp[k] = tmp[less];
+						tmp[less] = tmp[great];
+						++less;
+					}
+					else {
+						tmp[k] = tmp[great];
+					}
+					tmp[great] = ak;
+					--great;
+				}
+			}
+			left = great + 1;
+		}
+		if (left > right) {
+			break;
+		}
+	}
 	for (int i = 0; i < size; i++) {
-		a[tmp[i].pos] = tmp[i].val;
+		if (safeSet(tmp, i, imin)) {
+			imin += 1;
+		}
 	}
-	free(tmp);
+	killerFinish(a, tmp, size);
 	return;
 }
 
-/* function to generate test data and write to disk */
-static void generateTestData(SORT_TYPE* a, enum Pattern pattern, int size) {
+static int file_exist(char *filename)
+{
+	struct stat   buffer;
+	return (stat(filename, &buffer) == 0);
+}
+
+/*
+Binary test data file: the header, then the n elements of es bytes. For
+strings the elements are uint64_t offsets into a blob of NUL terminated
+strings that follows them, and loading turns them into pointers.
+*/
+typedef struct {
+	char magic[8];
+	uint32_t type;		/* type code */
+	uint32_t pattern;
+	uint64_t n;
+	uint64_t es;
+	uint64_t seed;		/* seed of the generator that made the data */
+	uint64_t blob;		/* bytes of strings after the elements, 0 for other types */
+	uint64_t checksum;	/* of everything after the header */
+	double param;		/* pattern parameter the data was generated with */
+} TestDataHeader;
+
+#define TEST_DATA_MAGIC "PGSORTD2"
 
-	//open file to write
+/* a loaded test data file, kept mapped while the strings of copy point into it */
+typedef struct {
+	void *map;
+	size_t size;
+} TestData;
+
+static void unloadTestData(TestData *data) {
+	if (!data->map) {
+		return;
+	}
+#if defined(__unix__) || defined(__APPLE__)
+	munmap(data->map, data->size);
+#else
+	free(data->map);
+#endif
+	data->map = NULL;
+}
+
+/* FNV-1a over 8 byte words, then the remaining bytes */
+static uint64_t checksum(const char *p, size_t size) {
+	uint64_t h = 14695981039346656037ULL, w;
+	size_t i = 0;
+
+	for (; i + sizeof(w) <= size; i += sizeof(w)) {
+		memcpy(&w, p + i, sizeof(w));
+		h = (h ^ w) * 1099511628211ULL;
+	}
+	for (; i < size; i++) {
+		h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+/* write array to disk as text, where no text file exists yet */
+static void exportTestData(const char* a, const BenchType *type, enum Pattern pattern, int size) {
 	char fname[30];
-	makeFileName(fname, pattern, size);
+	makeFileName(fname, type, pattern, size, "txt");
+	if (file_exist(fname)) {
+		return;
+	}
 	FILE *f = fopen(fname, "w");
 	if (!f) {
 		printf("Error writing to file: %s\n", fname);
 		exit(1);
 	}
+	for (int i = 0; i < size; i++) {
+		type->write(f, a + i*type->es);
+	}
+	fclose(f);
+}
+
+/* write array to disk in the binary format */
+static void writeTestData(const char* a, const BenchType *type, enum Pattern pattern, int size) {
+	TestDataHeader h;
+	size_t es = type->es;
+	size_t payload = size * es;
+	char *buf = (char*)a;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TEST_DATA_MAGIC, sizeof(h.magic));
+	h.type = (uint32_t)(type - bench_types);
+	h.pattern = pattern;
+	h.n = size;
+	h.es = es;
+	h.seed = bench_seed;
+	h.param = pattern_params[pattern];
+	if (type->strings) {
+		// offsets, then the strings they point to
+		for (int i = 0; i < size; i++) {
+			h.blob += strlen(*(char *const*)(a + i*es)) + 1;
+		}
+		payload = size * sizeof(uint64_t) + h.blob;
+		buf = malloc(payload);
+		if (!buf) {
+			fprintf(stderr, "Error allocating test data buffer: need %lu bytes", (unsigned long)payload);
+			exit(1);
+		}
+		uint64_t offset = 0;
+		for (int i = 0; i < size; i++) {
+			const char *str = *(char *const*)(a + i*es);
+			size_t len = strlen(str) + 1;
+			memcpy(buf + i * sizeof(uint64_t), &offset, sizeof(offset));
+			memcpy(buf + size * sizeof(uint64_t) + offset, str, len);
+			offset += len;
+		}
+	}
+	h.checksum = checksum(buf, payload);
+
+	char fname[30];
+	makeFileName(fname, type, pattern, size, "bin");
+	FILE *f = fopen(fname, "wb");
+	if (!f || fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(buf, 1, payload, f) != payload || fclose(f)) {
+		printf("Error writing to file: %s\n", fname);
+		exit(1);
+	}
+	if (buf != a) {
+		free(buf);
+	}
+}
+
+/* elements per chunk of the parallel fill, each chunk has its own stream */
+#define GENERATE_CHUNK (1 << 16)
+
+typedef struct {
+	char *a;
+	const BenchType *type;
+	int size;
+	PRNG rng;	/* stream of the thread's first chunk */
+	int thread, threads;
+} GenerateTask;
+
+/* chunks thread, thread + threads, ...; chunk c uses the stream jumped c times */
+static void *generateChunks(void *arg) {
+	GenerateTask *task = arg;
+	size_t es = task->type->es;
+
+	for (size_t c = task->thread; c * GENERATE_CHUNK < (size_t)task->size; c += task->threads) {
+		PRNG rng = task->rng;
+		size_t end = (c + 1) * GENERATE_CHUNK;
+		if (end > (size_t)task->size) {
+			end = task->size;
+		}
+		for (size_t i = c * GENERATE_CHUNK; i < end; i++) {
+			task->type->random(task->a + i*es, task->type, &rng);
+		}
+		for (int j = 0; j < task->threads; j++) {
+			prngJump(&task->rng);
+		}
+	}
+	return NULL;
+}
+
+/*
+fill a with random elements from rng, on several threads; the chunked streams
+make the result the same for any number of threads
+*/
+static void generateRandom(char* a, const BenchType *type, int size, PRNG *rng) {
+	GenerateTask tasks[SORT_MAX_THREADS];
+	pthread_t threads[SORT_MAX_THREADS];
+	long cpus = SORT_THREADS ? SORT_THREADS : sysconf(_SC_NPROCESSORS_ONLN);
+	long chunks = (size + GENERATE_CHUNK - 1) / GENERATE_CHUNK;
+	int count = (int)(cpus < chunks ? cpus : chunks);
+
+	if (count > SORT_MAX_THREADS) {
+		count = SORT_MAX_THREADS;
+	}
+	if (count < 1) {
+		count = 1;
+	}
 
-	//generate data
+	for (int t = 0; t < count; t++) {
+		tasks[t].a = a;
+		tasks[t].type = type;
+		tasks[t].size = size;
+		tasks[t].rng = *rng;
+		tasks[t].thread = t;
+		tasks[t].threads = count;
+		prngJump(rng);
+	}
+	for (int t = 1; t < count; t++) {
+		if (pthread_create(&threads[t], NULL, generateChunks, &tasks[t])) {
+			fprintf(stderr, "Error creating thread for data generation\n");
+			exit(1);
+		}
+	}
+	generateChunks(&tasks[0]);
+	for (int t = 1; t < count; t++) {
+		pthread_join(threads[t], NULL);
+	}
+}
+
+/* pickers of key indexes, for fillFromKeys */
+static int pickUniform(PRNG *rng, int keys, double param) {
+	return prngBelow(rng, keys);
+}
+
+/* continuous approximation of the Zipf distribution, by inversion */
+static int pickZipf(PRNG *rng, int keys, double s) {
+	double u = prngDouble(rng), x;
+
+	if (s == 1.0) {
+		x = pow(keys + 1.0, u);
+	}
+	else {
+		x = pow((pow(keys + 1.0, 1 - s) - 1) * u + 1, 1 / (1 - s));
+	}
+	int k = (int)x - 1;
+	return k < 0 ? 0 : k >= keys ? keys - 1 : k;
+}
+
+/* Box-Muller around the middle key */
+static int pickGaussian(PRNG *rng, int keys, double sigma) {
+	double z = sqrt(-2 * log(1 - prngDouble(rng))) * cos(6.283185307179586 * prngDouble(rng));
+	double k = keys / 2.0 + z * sigma * keys;
+	return k < 0 ? 0 : k >= keys ? keys - 1 : (int)k;
+}
+
+/*
+generate keys random elements, sorted if asked to, and fill a with copies of
+the ones pick chooses; returns the keys, which own what string elements point to
+*/
+static char* fillFromKeys(char* a, const BenchType *type, int size, int keys, bool sorted,
+	int(*pick)(PRNG*, int, double), double param, PRNG *rng, PRNG *shape) {
+	size_t es = type->es;
+	char* dict = (char*)malloc(keys * es);
+	if (!dict) {
+		fprintf(stderr, "Error allocating keys: need %lu bytes", (unsigned long)(keys * es));
+		exit(1);
+	}
+	generateRandom(dict, type, keys, rng);
+	if (sorted) {
+		qsort(dict, keys, es, type->order);
+	}
 	for (int i = 0; i < size; i++) {
-#ifdef INT_GEN
-		a[i] = random_int(MAX_INT);
-#elif defined STR_GEN
-		a[i] = malloc(sizeof(char)*MAX_STR_LEN);
-		rand_string(a[i], MAX_STR_LEN);
-#elif defined DOU_GEN
-		a[i] = (double)random_int(MAX_INT);
-#endif
+		memcpy(a + i*es, dict + pick(shape, keys, param)*es, es);
+	}
+	return dict;
+}
+
+/* sort elements [from, to) of a with cmp */
+static void sortRange(char* a, size_t es, int from, int to, int(*cmp)(const void*, const void*)) {
+	if (to > from) {
+		qsort(a + from*es, to - from, es, cmp);
+	}
+}
+
+/* one stream per file, so the data does not depend on what else was generated */
+static void patternPrng(PRNG *rng, const BenchType *type, enum Pattern pattern, int size) {
+	prngSeed(rng, bench_seed ^ (uint64_t)(type - bench_types) << 56 ^ (uint64_t)pattern << 48 ^ (uint64_t)size);
+}
+
+/* function to generate test data and write to disk */
+static void generateTestData(char* a, const BenchType *type, enum Pattern pattern, int size) {
+	size_t es = type->es;
+	double param = pattern_params[pattern];
+	char* dict = NULL;
+	int keys = 0;
+	PRNG rng, shape;
+
+	patternPrng(&rng, type, pattern, size);
+	shape = rng;
+	prngLongJump(&shape);
+
+	//generate data, or the keys of the patterns that choose among them
+	switch (pattern) {
+	case ZIPF:
+		dict = fillFromKeys(a, type, size, keys = size, false, pickZipf, param, &rng, &shape);
+		break;
+	case FEW_UNIQUE:
+		keys = param < 1 ? 1 : param > size ? size : (int)param;
+		dict = fillFromKeys(a, type, size, keys, false, pickUniform, param, &rng, &shape);
+		break;
+	case ALL_EQUAL:
+		dict = fillFromKeys(a, type, size, keys = 1, false, pickUniform, param, &rng, &shape);
+		break;
+	case GAUSSIAN:
+		dict = fillFromKeys(a, type, size, keys = size, true, pickGaussian, param, &rng, &shape);
+		break;
+	default:
+		generateRandom(a, type, size, &rng);
+		break;
 	}
 
 	//deal with pattern
+	generating = type;
 	switch (pattern) {
 	case UNSORTED:
 		break;
 	case SORTED:
-		qsort(a, size, sizeof(SORT_TYPE), cmp);
+		qsort(a, size, es, type->order);
 		break;
 	case REVERSED:
-		qsort(a, size, sizeof(SORT_TYPE), cmp_reverse);
+		qsort(a, size, es, cmp_reverse);
 		break;
 	case MOSTLY_SORTED:
-		qsort(a, size, sizeof(SORT_TYPE), cmp);
-		shuffleArray(a, size, size / BIN_NUM);
+		qsort(a, size, es, type->order);
+		shuffleArray(a, size, es, size / BIN_NUM, &shape);
 		break;
 	case MOSTLY_REVERSED:
-		qsort(a, size, sizeof(SORT_TYPE), cmp_reverse);
-		shuffleArray(a, size, size / BIN_NUM);
+		qsort(a, size, es, cmp_reverse);
+		shuffleArray(a, size, es, size / BIN_NUM, &shape);
 		break;
 	case KILLER:
-		qsort(a, size, sizeof(SORT_TYPE), cmp);
-		generateMedKiller(a, size);
+		qsort(a, size, es, type->order);
+		generateMedKiller(a, type, size);
+		break;
+	case DUAL_PIVOT_KILLER:
+		qsort(a, size, es, type->order);
+		generateDualPivotKiller(a, type, size);
+		break;
+	case SAWTOOTH: {
+		int teeth = param < 1 ? 1 : (int)param;
+		for (int t = 0; t < teeth; t++) {
+			sortRange(a, es, (int)((long long)size * t / teeth), (int)((long long)size * (t + 1) / teeth), type->order);
+		}
+		break;
+	}
+	case ORGAN_PIPE: {
+		int runs = 2 * (param < 1 ? 1 : (int)param);
+		for (int r = 0; r < runs; r++) {
+			sortRange(a, es, (int)((long long)size * r / runs), (int)((long long)size * (r + 1) / runs),
+				r % 2 ? cmp_reverse : type->order);
+		}
+		break;
+	}
+	case RANDOM_RUNS: {
+		uint32_t mean = param < 1 ? 1 : (uint32_t)param;
+		for (int i = 0; i < size; ) {
+			int len = 1 + prngBelow(&shape, 2 * mean);
+			int end = len < size - i ? i + len : size;
+			sortRange(a, es, i, end, type->order);
+			i = end;
+		}
+		break;
+	}
+	case PUSH_FRONT:
+		sortRange(a, es, param < size ? (int)param : size, size, type->order);
+		break;
+	case PUSH_BACK:
+		sortRange(a, es, 0, param < size ? size - (int)param : 0, type->order);
+		break;
+	case SORTED_TAIL:
+		sortRange(a, es, 0, size - (int)(size * (param < 1 ? param : 1)), type->order);
 		break;
 	default:
 		break;
 	}
 
-	/* write array to file */
+	writeTestData(a, type, pattern, size);
+
+	// the keys own the strings the elements share
+	if (dict) {
+		a = dict;
+		size = keys;
+	}
+	if (type->release) {
+		for (int i = 0; i < size; i++) {
+			type->release(a + i*es);
+		}
+	}
+	free(dict);
+}
+
+/*
+McIlroy's "A Killer Adversary for Quicksort": the sort runs on element numbers
+and values are decided lazily. All start as gas, larger than any solid value;
+when two gas elements are compared, one is frozen to the next solid value,
+preferring the one that is not the latest gas element seen (likely the
+pivot), so the pivot stays gas and ends up larger than its partition. The
+answers stay consistent, and the frozen values are an input on which the
+sort makes the same comparisons.
+*/
+static int *gas_val;
+static int gas, gas_solid, gas_candidate;
+static unsigned long long gas_comparisons;
+static pthread_mutex_t gas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int cmpGas(const void *px, const void *py) {
+	int x, y, r;
+
+	memcpy(&x, px, sizeof(int));
+	memcpy(&y, py, sizeof(int));
+
+	// the parallel engines compare from several threads
+	pthread_mutex_lock(&gas_lock);
+	gas_comparisons++;
+	if (gas_val[x] == gas && gas_val[y] == gas) {
+		if (x == gas_candidate) {
+			gas_val[x] = gas_solid++;
+		}
+		else {
+			gas_val[y] = gas_solid++;
+		}
+	}
+	if (gas_val[x] == gas) {
+		gas_candidate = x;
+	}
+	else if (gas_val[y] == gas) {
+		gas_candidate = y;
+	}
+	r = (gas_val[x] > gas_val[y]) - (gas_val[x] < gas_val[y]);
+	pthread_mutex_unlock(&gas_lock);
+	return r;
+}
+
+/*
+adversarial input for sort: play the adversary against it, then give the
+element that got rank r the r-th smallest of size random elements. Not cached,
+the input belongs to the routine. The adversary's elements are as wide as the
+type's, numbered in their first bytes, since some engines size their blocks by
+es; only char elements are too narrow and get int wide ones. False if sort
+never called the comparator, like the radix and counting sorts: there is no
+adversary for them, only the already sorted element numbers.
+*/
+static bool generateAdversary(char* a, const BenchType *type, int size, const char* name,
+	void(*sort)(void*, size_t, size_t, int(*)(const void*, const void*))) {
+	size_t es = type->es;
+	size_t ptr_es = es < sizeof(int) ? sizeof(int) : es;
+	char* ptr = (char*)calloc(size, ptr_es);
+	char* sorted = (char*)malloc(size * es);
+	PRNG rng;
+
+	gas_val = (int*)malloc(sizeof(int)*size);
+	if (!ptr || !sorted || !gas_val) {
+		fprintf(stderr, "Error allocating adversary: need %lu bytes", (unsigned long)(size * (ptr_es + es + sizeof(int))));
+		exit(1);
+	}
+	for (int i = 0; i < size; i++) {
+		memcpy(ptr + i*ptr_es, &i, sizeof(int));
+		gas_val[i] = size;
+	}
+	gas = size;
+	gas_solid = 0;
+	// no candidate yet: the first pair of gas elements is answered as a descent,
+	// which ends the presorted checks of pg_qsort and friends at once
+	gas_candidate = -1;
+	gas_comparisons = 0;
+	sort(ptr, size, ptr_es, cmpGas);
+
+	if (gas_comparisons == 0 && size > 1) {
+		fprintf(stderr, "antiqsort: %s does not call the comparator, skipped\n", name);
+		free(sorted);
+		free(gas_val);
+		free(ptr);
+		return false;
+	}
+
+	// gas never compared with other gas, any order among them is consistent
 	for (int i = 0; i < size; i++) {
-#ifdef INT_GEN
-		fprintf(f, "%d ", a[i]);
-#elif defined STR_GEN
-		fprintf(f, "%s ", a[i]);
-#elif defined DOU_GEN
-		fprintf(f, "%lf ", a[i]);
-#endif
+		if (gas_val[i] == gas) {
+			gas_val[i] = gas_solid++;
+		}
 	}
+	fprintf(stderr, "antiqsort: %s n=%d comparisons=%llu (%.2lf n log2 n)\n", name, size, gas_comparisons,
+		gas_comparisons / (size * log2(size > 1 ? size : 2)));
 
-	/* close file */
-	fclose(f);
+	patternPrng(&rng, type, ANTIQSORT, size);
+	generateRandom(sorted, type, size, &rng);
+	qsort(sorted, size, es, type->order);
+	for (int i = 0; i < size; i++) {
+		memcpy(a + i*es, sorted + gas_val[i] * es, es);
+	}
+	free(sorted);
+	free(gas_val);
+	free(ptr);
+	return true;
 }
 
-/* read array data from disk */
-static void readTestData(SORT_TYPE* a, enum Pattern pattern, int size) {
-	// open file
+/*
+read array data from disk: maps the binary file and copies the elements to a,
+false if there is no file for type, pattern and size or it does not check out
+*/
+static bool readTestData(char* a, const BenchType *type, enum Pattern pattern, int size, TestData *data) {
 	char fname[30];
-	makeFileName(fname, pattern, size);
-	FILE *f = fopen(fname, "r");
+	struct stat st;
+	const TestDataHeader *h;
+	size_t es = type->es;
 
-	// read data
-	for (int i = 0; i < size; i++) {
-#ifdef INT_GEN
-		fscanf(f,"%d", &a[i]);
-#elif defined STR_GEN
-		a[i] = malloc(sizeof(char)*MAX_STR_LEN);
-		fscanf(f, "%s", a[i]);
-#elif defined DOU_GEN
-		fscanf(f, "%lf", &a[i]);
+	data->map = NULL;
+	makeFileName(fname, type, pattern, size, "bin");
+#if defined(__unix__) || defined(__APPLE__)
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(TestDataHeader)) {
+		data->size = st.st_size;
+		data->map = mmap(NULL, data->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data->map == MAP_FAILED) {
+			data->map = NULL;
+		}
+	}
+	close(fd);
+#else
+	FILE *f = fopen(fname, "rb");
+	if (!f) {
+		return false;
+	}
+	if (stat(fname, &st) == 0 && st.st_size >= (long)sizeof(TestDataHeader)) {
+		data->size = st.st_size;
+		data->map = malloc(data->size);
+		if (data->map && fread(data->map, 1, data->size, f) != data->size) {
+			free(data->map);
+			data->map = NULL;
+		}
+	}
+	fclose(f);
 #endif
+	if (!data->map) {
+		return false;
 	}
 
-	//close file
-	fclose(f);
+	h = data->map;
+	const char *payload = (const char*)(h + 1);
+	size_t elements = size * (type->strings ? sizeof(uint64_t) : es);
+	if (memcmp(h->magic, TEST_DATA_MAGIC, sizeof(h->magic)) || h->type != (uint32_t)(type - bench_types) ||
+		h->pattern != (uint32_t)pattern || h->n != (uint64_t)size || h->es != es || h->seed != bench_seed || h->param != pattern_params[pattern] ||
+		data->size != sizeof(*h) + elements + h->blob || checksum(payload, elements + h->blob) != h->checksum) {
+		if (h->seed != bench_seed) {
+			fprintf(stderr, "%s was generated with seed %llu, generating it again\n", fname, (unsigned long long)h->seed);
+		}
+		else if (h->param != pattern_params[pattern]) {
+			fprintf(stderr, "%s was generated with %s=%g, generating it again\n", fname, pattern_names[pattern], h->param);
+		}
+		else {
+			fprintf(stderr, "%s does not check out, generating it again\n", fname);
+		}
+		unloadTestData(data);
+		return false;
+	}
+
+	if (type->strings) {
+		const char *blob = payload + elements;
+		for (int i = 0; i < size; i++) {
+			uint64_t offset;
+			memcpy(&offset, payload + i * sizeof(uint64_t), sizeof(offset));
+			*(const char**)(a + i*es) = blob + offset;
+		}
+	}
+	else {
+		memcpy(a, payload, elements);
+	}
+	return true;
 }
 
-static int file_exist(char *filename)
-{
-	struct stat   buffer;
-	return (stat(filename, &buffer) == 0);
+/* summary of the timed runs of one routine, pattern and size, in nanoseconds */
+typedef struct {
+	int runs;
+	double mean, min, median, p90, stddev;
+	double ci95;	/* half width of the 95% confidence interval of the mean */
+} Timing;
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
 }
 
+/* two sided 95% quantile of Student's t distribution */
+static double t95(int df) {
+	static const double t[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+	return df <= 30 ? t[df - 1] : 1.96;
+}
+
+/* sorts samples */
+static void timingStats(double *samples, int runs, Timing *t) {
+	double sum = 0, sq = 0;
+
+	qsort(samples, runs, sizeof(double), cmp_double);
+	for (int i = 0; i < runs; i++) {
+		sum += samples[i];
+	}
+	t->runs = runs;
+	t->mean = sum / runs;
+	for (int i = 0; i < runs; i++) {
+		sq += (samples[i] - t->mean) * (samples[i] - t->mean);
+	}
+	t->min = samples[0];
+	t->median = runs % 2 ? samples[runs / 2] : (samples[runs / 2 - 1] + samples[runs / 2]) / 2;
+	t->p90 = samples[(9 * runs + 9) / 10 - 1];
+	t->stddev = runs > 1 ? sqrt(sq / (runs - 1)) : 0;
+	t->ci95 = runs > 1 ? t95(runs - 1) * t->stddev / sqrt(runs) : 0;
+}
+
+/*
+whether the comma separated list has an entry equal to name or to number, or
+with substring set an entry contained in name; a NULL list selects everything
+*/
+static bool selected(const char *list, const char *name, int number, bool substring) {
+	if (!list) {
+		return true;
+	}
+	for (const char *s = list; ; s++) {
+		const char *e = strchr(s, ',');
+		size_t len = e ? (size_t)(e - s) : strlen(s);
+		char token[128];
+		char *end;
+
+		if (len < sizeof(token)) {
+			memcpy(token, s, len);
+			token[len] = '\0';
+			if (substring ? strstr(name, token) != NULL : !strcmp(token, name)) {
+				return true;
+			}
+			if (number >= 0 && len && strtol(token, &end, 10) == number && *end == '\0') {
+				return true;
+			}
+		}
+		if (!e) {
+			return false;
+		}
+		s = e;
+	}
+}
+
+/* the sizes to test: the filter's, or min, 10 min, ... max as long as the arrays of es byte elements fit MAX_BYTES */
+static int testSizes(int min, int max, size_t es, int *sizes, int capacity) {
+	int count = 0;
+
+	if (filter && filter->sizes) {
+		for (const char *s = filter->sizes; *s && count < capacity; s++) {
+			long n = strtol(s, NULL, 10);
+			if (n > 0 && n <= INT_MAX) {
+				sizes[count++] = (int)n;
+			}
+			s = strchr(s, ',');
+			if (!s) {
+				break;
+			}
+		}
+		return count;
+	}
+	for (int n = min; n <= max && count < capacity; n *= 10) {
+		if (n > max / 10 && (unsigned long long)n * es > MAX_BYTES) {
+			break;
+		}
+		sizes[count++] = n;
+	}
+	return count;
+}
+
+/*
+rounds is the minimum number of timed runs: after WARMUP untimed runs the routine
+is timed until the 95% confidence interval of the mean is within CI_TARGET of it,
+MAX_REPEAT runs were made or MAX_SECONDS were spent
+*/
 void testSorting(void(*sort)(void*, size_t,size_t,int(*)(const void*,const void*)),
-	SORT_TYPE* a, SORT_TYPE* copy, int min, int max, int rounds, char* name) {
-	clock_t start_t, end_t;
+	const BenchType *type, void* a, void* copy, int min, int max, int rounds, char* name) {
+	double samples[MAX_REPEAT];
+	double counters[PERF_COUNTERS], run_counters[PERF_COUNTERS];
+	int sizes[32];
+	int sizeCount = testSizes(min, max, type->es, sizes, 32);
+	size_t es = type->es;
 
-	for (enum Pattern p = SORTED; p <= KILLER; p++) {
-		for (int n = min; n <= max; n *= 10) {
-			if (p == KILLER && n > max / 10) {
+	if (filter && !selected(filter->routines, name, -1, true)) {
+		return;
+	}
+
+	perfCountersOpen();
+	// strings are pointers to their keys, which the engines prefetch with SORT_PREFETCH_DISTANCE
+	sort_pointer_keys(type->strings);
+
+	for (enum Pattern p = SORTED; p < PATTERNS; p++) {
+		if (filter && !selected(filter->patterns, pattern_names[p], p, false)) {
+			continue;
+		}
+		for (int s = 0; s < sizeCount; s++) {
+			int n = sizes[s];
+			// only explicitly requested sizes are that large for the killers
+			if ((p == KILLER || p == DUAL_PIVOT_KILLER || p == ANTIQSORT) && n > max / 10 && !(filter && filter->sizes)) {
 				break;
 			}
-			char fname[30];
-			makeFileName(fname, p, n);
-			if (!file_exist(fname)) {
-				generateTestData(copy, p, n);
+			TestData data;
+			if (p == ANTIQSORT) {
+				if (!generateAdversary(copy, type, n, name, sort)) {
+					break;
+				}
+				data.map = NULL;
 			}
-			else {
-				readTestData(copy, p, n);
+			else if (!readTestData(copy, type, p, n, &data)) {
+				generateTestData(copy, type, p, n);
+				if (!readTestData(copy, type, p, n, &data)) {
+					printf("Error reading test data of %s, pattern %d, n %d\n", type->name, p, n);
+					exit(1);
+				}
+			}
+			if (bench_export_text && p != ANTIQSORT) {
+				exportTestData(copy, type, p, n);
 			}
-			int ticksum = 0;
-			for (int r = 0; r < rounds; r++) {
-				memcpy(a, copy, n * sizeof(SORT_TYPE));
-				start_t = clock();
-				sort(a, n, sizeof(SORT_TYPE),cmp);
-				end_t = clock();
-				ticksum += end_t - start_t;
+			for (int r = 0; r < WARMUP; r++) {
+				memcpy(a, copy, n * es);
+				sort(a, n, es, type->cmp);
 			}
+#ifdef COUNT_COMPARISONS
+			comparisons = 0;
+#endif
+#ifdef SORT_STATS
+			sort_stats_reset();
+#endif
+			Timing t;
+			double spent = 0;
+			int runs = 0;
+			for (int i = 0; i < PERF_COUNTERS; i++) {
+				counters[i] = 0;
+			}
+			while (runs < MAX_REPEAT) {
+				memcpy(a, copy, n * es);
+				perfCountersStart();
+				double start = now_ns();
+				sort(a, n, es, type->cmp);
+				samples[runs] = now_ns() - start;
+				perfCountersStop(run_counters);
+				spent += samples[runs++];
+				// a counter missing in any run stays missing for the cell
+				for (int i = 0; i < PERF_COUNTERS; i++) {
+					counters[i] = counters[i] < 0 || run_counters[i] < 0 ? -1 : counters[i] + run_counters[i];
+				}
+				if (runs >= rounds) {
+					timingStats(samples, runs, &t);
+					if (t.ci95 <= CI_TARGET * t.mean || spent >= MAX_SECONDS * 1e9) {
+						break;
+					}
+				}
+			}
+			timingStats(samples, runs, &t);
 			bool correct = true;
+			char *e = a;
 #ifdef PRINTOUT
 			for (int i = 0; i < n - 1; i++) {
-				printf("%d ", a[i]);
+				type->write(stdout, e + i*es);
 			}
 #endif
 			for (int i = 0; i < n - 1; i++) {
-				if (SORT_CMP(a[i], a[i + 1]) > 0) {
+				if (type->order(e + i*es, e + (i + 1)*es) > 0) {
 					correct = false;
 					break;
 				}
 			}
+			for (int i = 0; correct && type->intact && i < n; i++) {
+				correct = type->intact(e + i*es, type);
+			}
 
-			printf("%s,%d,%d,%d,%.3lf\n", name, p, n, correct, 1.0*ticksum / rounds);
-
-#ifdef STR_GEN
-			// free strings
-			for (int i = 0; i < n; i++) {
-				free(copy[i]);
+			printf("%s,%s,%s,%llu,%d,%d,%d,%d,%.0lf,%.0lf,%.0lf,%.0lf,%.0lf,%.0lf", name, type->name,
+				bench_pages_names[bench_pages], bench_seed, p, n, correct,
+				t.runs, t.mean, t.min, t.median, t.p90, t.stddev, t.ci95);
+#ifdef COUNT_COMPARISONS
+			// empty for routines that sort without the comparator, like tim_sort_int's merge kernels
+			if (comparisons == 0 && n > 1) {
+				printf(",");
 			}
+			else {
+				printf(",%.0lf", 1.0*comparisons / runs);
+			}
+#endif
+#ifdef SORT_STATS
+			printf(",%.0lf,%.0lf,%.0lf,%llu,%.2lf", 1.0*sort_stats.swaps / runs, 1.0*sort_stats.moves / runs,
+				1.0*sort_stats.bytes_moved / runs, (unsigned long long)sort_stats.max_depth,
+				1.0*sort_stats.heap_fallbacks / runs);
 #endif
+			// mean per run, empty where the counter is unavailable
+			for (int i = 0; i < PERF_COUNTERS; i++) {
+				if (counters[i] < 0) {
+					printf(",");
+				}
+				else {
+					printf(",%.0lf", counters[i] / runs);
+				}
+			}
+			printf("\n");
+
+			// adversarial data is not mapped, it owns its strings
+			if (!data.map && type->release) {
+				for (int i = 0; i < n; i++) {
+					type->release((char*)copy + i*es);
+				}
+			}
+			unloadTestData(&data);
 		}
 	}
 }
 
-void test() {
-	SORT_TYPE a[MAX_N];
-	SORT_TYPE copy[MAX_N];
+/* log the decisions of pg_sort_auto, result.csv only gets the timings */
+static void log_sort_auto(const PG_SORT_AUTO_STATS *stats) {
+	fprintf(stderr, "pg_sort_auto: n=%lu descents=%.3lf inversions=%.3lf duplicates=%.3lf -> %s\n",
+		(unsigned long)stats->n, stats->descents, stats->inversions, stats->duplicates, stats->engine);
+}
 
-	printf("sorting routine,pattern,n,correct,time(CPU clock ticks)\n");
+/* bytes moved and phase times of tiled_sort on the large inputs it is meant for */
+static void log_tiled_sort(const TILED_SORT_STATS *stats) {
+	if (stats->n < 10000000) {
+		return;
+	}
 
-	testSorting(heap_sort_wrapper, a, copy, MIN_N, MAX_N, REPEAT, "heap sort");
+	fprintf(stderr, "tiled_sort: n=%lu tiles=%lu tile_n=%lu bytes moved=%llu tile ms=%.3f merge ms=%.3f\n",
+		(unsigned long)stats->n, (unsigned long)stats->tiles, (unsigned long)stats->tile_n,
+		stats->bytes_moved, stats->tile_ns / 1e6, stats->merge_ns / 1e6);
+}
 
-	testSorting(tim_sort, a, copy, MIN_N, MAX_N, REPEAT, "tim sort");
+/* radix_sort takes int arrays only */
+static void radix_sort_wrapper(void *a, size_t n, size_t es, int(*cmp)(const void*, const void*)) {
+	(void)es;
+	(void)cmp;
+	radix_sort(a, n);
+}
 
-	testSorting(dual_pivot_quick_sort, a, copy, MIN_N, MAX_N, REPEAT, "dual pivot quick sort");
+/* so does the 4-way merge sort of sort.h */
+static void merge_sort_4way_wrapper(void *a, size_t n, size_t es, int(*cmp)(const void*, const void*)) {
+	(void)es;
+	(void)cmp;
+	i32_merge_sort_4way(a, n);
+}
 
-	//testSorting(quick_sort, a, copy, MIN_N, MAX_N, REPEAT, "median of 3 quick sort");
+/* every routine on one type */
+static void testType(const BenchType *type, void *a, void *copy) {
+	testSorting(heap_sort_wrapper, type, a, copy, MIN_N, MAX_N, REPEAT, "heap sort");
 
-#ifdef INT_GEN
-	testSorting(radix_sort, a, copy, MIN_N, MAX_N, REPEAT, "radix sort");
-#endif
+	testSorting(heap_sort4_wrapper, type, a, copy, MIN_N, MAX_N, REPEAT, "4-ary heap sort");
+
+	testSorting(tim_sort, type, a, copy, MIN_N, MAX_N, REPEAT, "tim sort");
+
+	testSorting(dual_pivot_quick_sort, type, a, copy, MIN_N, MAX_N, REPEAT, "dual pivot quick sort");
+
+	//testSorting(quick_sort, type, a, copy, MIN_N, MAX_N, REPEAT, "median of 3 quick sort");
+
+	if (type->int_keys) {
+		if (type->es == sizeof(int)) {
+			testSorting(radix_sort_wrapper, type, a, copy, MIN_N, MAX_N, REPEAT, "radix sort");
+
+			testSorting(merge_sort_4way_wrapper, type, a, copy, MIN_N, MAX_N, REPEAT, "4-way merge sort");
+		}
+
+		testSorting(counting_sort, type, a, copy, MIN_N, MAX_N, REPEAT, "counting sort");
+
+		testSorting(parallel_radix_sort, type, a, copy, MIN_N, MAX_N, REPEAT, "parallel radix sort");
+
+		// every kernel variant this CPU supports, then back to the best one
+		for (SORT_ISA isa = SORT_ISA_SCALAR; isa <= sort_isa_detect(); isa++) {
+			char name[64];
+			sort_isa_force(isa);
+			sprintf(name, "tim sort - simd merge (%s)", sort_isa_name(isa));
+			testSorting(tim_sort_int, type, a, copy, MIN_N, MAX_N, REPEAT, name);
+			if (type->es == sizeof(int)) {
+				sprintf(name, "parallel radix sort - scatter (%s)", sort_isa_name(isa));
+				testSorting(parallel_radix_sort, type, a, copy, MIN_N, MAX_N, REPEAT, name);
+			}
+		}
+		sort_isa_force(sort_isa_detect());
+	}
 
 	// pg intro sort
-	testSorting(pg_qsort, a, copy, MIN_N, MAX_N, REPEAT, "pg intro sort");
+	testSorting(pg_qsort, type, a, copy, MIN_N, MAX_N, REPEAT, "pg intro sort");
+
+	// pg intro sort, median of sqrt(n) pivots
+	testSorting(pg_qsort_sampled, type, a, copy, MIN_N, MAX_N, REPEAT, "pg intro sort - sqrt(n) sample pivot");
+
+	// pg intro sort, inputs of a few runs merged by tim sort
+	testSorting(pg_qsort_merge_runs, type, a, copy, MIN_N, MAX_N, REPEAT, "pg intro sort - run merge");
 
 	// pg intro sort once
-	testSorting(pg_qsort_once, a, copy, MIN_N, MAX_N, REPEAT, "pg intro sort - 1 preordered check");
+	testSorting(pg_qsort_once, type, a, copy, MIN_N, MAX_N, REPEAT, "pg intro sort - 1 preordered check");
+
+	// pg intro sort with near-sorted repair
+	testSorting(pg_qsort_repair, type, a, copy, MIN_N, MAX_N, REPEAT, "pg intro sort - near-sorted repair");
+
+	// pg intro sort on pointers, then each element moved once
+	if (type->es > sizeof(char*)) {
+		testSorting(pg_qsort_indirect, type, a, copy, MIN_N, MAX_N, REPEAT, "pg intro sort - indirect");
+	}
+
+	// pg intro sort, parallel partition on the top levels
+	testSorting(parallel_pg_qsort, type, a, copy, MIN_N, MAX_N, REPEAT, "parallel pg intro sort");
+
+	// in-place parallel sample sort
+	testSorting(ips4o_sort, type, a, copy, MIN_N, MAX_N, REPEAT, "ips4o sample sort");
+
+	// cache sized tiles sorted by pg_qsort, then one multiway merge
+	tiled_sort_hook = log_tiled_sort;
+	testSorting(tiled_sort, type, a, copy, MIN_N, MAX_N, REPEAT, "tiled sort - cache sized tiles + multiway merge");
 
 	// pg qsort
-	testSorting(rand_pg_qsort, a, copy, MIN_N, MAX_N, REPEAT, "rand pg_qsort");
+	testSorting(rand_pg_qsort, type, a, copy, MIN_N, MAX_N, REPEAT, "rand pg_qsort");
 
 	// pg qsort
-	testSorting(old_pg_qsort, a, copy, MIN_N, MAX_N, REPEAT, "pg_qsort");
+	testSorting(old_pg_qsort, type, a, copy, MIN_N, MAX_N, REPEAT, "pg_qsort");
+
+	// adaptive dispatcher
+	pg_sort_auto_hook = log_sort_auto;
+	if (type->int_keys) {
+		testSorting(pg_sort_auto_int, type, a, copy, MIN_N, MAX_N, REPEAT, "pg_sort_auto");
+	}
+	else {
+		testSorting(pg_sort_auto, type, a, copy, MIN_N, MAX_N, REPEAT, "pg_sort_auto");
+	}
+}
+
+/* the arrays are mapped in whole and aligned huge pages */
+#define BENCH_HUGE_PAGE ((size_t)2 << 20)
+
+/*
+The benchmark arrays are mapped rather than malloc'ed, so they can be put on
+the pages bench_pages asks for, and are pre-faulted: every page is written
+once here, so no timed run pays for page faults on them.
+*/
+static void *benchAlloc(size_t size) {
+	void *p;
+#if defined(__unix__) || defined(__APPLE__)
+	size = (size + BENCH_HUGE_PAGE - 1) / BENCH_HUGE_PAGE * BENCH_HUGE_PAGE;
+	p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (bench_pages == PAGES_HUGETLB) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p == MAP_FAILED) {
+			fprintf(stderr, "No hugetlbfs pages for %lu bytes (see /proc/sys/vm/nr_hugepages), using transparent huge pages\n",
+				(unsigned long)size);
+			bench_pages = PAGES_THP;
+		}
+	}
+#endif
+	if (p == MAP_FAILED) {
+		// map a huge page more and cut the ends off, so the array starts on a huge page boundary
+		char *m = mmap(NULL, size + BENCH_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m != MAP_FAILED) {
+			size_t head = (BENCH_HUGE_PAGE - (uintptr_t)m % BENCH_HUGE_PAGE) % BENCH_HUGE_PAGE;
+			if (head) {
+				munmap(m, head);
+			}
+			munmap(m + head + size, BENCH_HUGE_PAGE - head);
+			p = m + head;
+		}
+	}
+	if (p == MAP_FAILED) {
+		p = NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if (p && bench_pages == PAGES_THP) {
+		madvise(p, size, MADV_HUGEPAGE);
+	}
+	if (p && bench_pages == PAGES_SMALL) {
+		madvise(p, size, MADV_NOHUGEPAGE);
+	}
+#endif
+#else
+	p = malloc(size);
+#endif
+	if (!p) {
+		fprintf(stderr, "Error allocating benchmark arrays: need %lu bytes", (unsigned long)size);
+		exit(1);
+	}
+
+	for (size_t i = 0; i < size; i += 4096) {
+		((volatile char*)p)[i] = 0;
+	}
+	return p;
+}
+
+static void benchFree(void *p, size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+	munmap(p, (size + BENCH_HUGE_PAGE - 1) / BENCH_HUGE_PAGE * BENCH_HUGE_PAGE);
+#else
+	free(p);
+#endif
+}
+
+/* every selected routine on one type, in arrays sized for its largest elements */
+static void testTypeArrays(const BenchType *type) {
+	int sizes[32];
+	int sizeCount = testSizes(MIN_N, MAX_N, type->es, sizes, 32);
+	size_t n = 0, es = type->es;
+
+	for (int i = 0; i < sizeCount; i++) {
+		n = sizes[i] > n ? sizes[i] : n;
+	}
+	void *a = benchAlloc(n * es);
+	void *copy = benchAlloc(n * es);
+	fprintf(stderr, "benchmark arrays for %s: 2 x %lu bytes on %s pages, data seed %llu\n", type->name,
+		(unsigned long)(n * es), bench_pages_names[bench_pages], bench_seed);
+
+	testType(type, a, copy);
+
+	benchFree(a, n * es);
+	benchFree(copy, n * es);
+}
+
+void test(const BenchFilter *selection) {
+	filter = selection;
+
+	printf("sorting routine,data type,pages,seed,pattern,n,correct,runs,mean(ns),min(ns),median(ns),p90(ns),stddev(ns),ci95(ns)");
+#ifdef COUNT_COMPARISONS
+	printf(",comparisons");
+#endif
+#ifdef SORT_STATS
+	printf(",swaps,moves,bytes moved,max recursion depth,heap sort fallbacks");
+#endif
+	for (int i = 0; i < PERF_COUNTERS; i++) {
+		printf(",%s", perf_counter_names[i]);
+	}
+	printf("\n");
+
+	for (int i = 0; i < BENCH_TYPES; i++) {
+		if (!filter || selected(filter->types, bench_types[i].name, i, false)) {
+			testTypeArrays(&bench_types[i]);
+		}
+	}
 }
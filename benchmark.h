@@ -5,70 +5,105 @@
 #include <string.h>
 #include <time.h>
 
+#include "prng.h"
+
 /*
 Sorting Benchmark
 Array Patterns:
-sorted, unsorted(random), mostly sorted, reversed, mostly reversed
-Data Type:
-int(0), char(1), string(2), struct
+sorted, unsorted(random), mostly sorted, reversed, mostly reversed, killer,
+dual pivot killer, zipf, few unique, all equal, sawtooth, organ pipe,
+random runs, push front, push back, gaussian, sorted with random tail,
+antiqsort (McIlroy's adversary against the routine under test)
+Data Types:
+int, char, string, double, in high and low cardinality, and records of a key and
+a 16 to 256 byte payload, chosen at run time
 */
 
-#ifndef TYPE_CODE
-#define TYPE_CODE 0
+#define BIN_NUM 100
+#define MIN_N 100000
+#define MAX_N 10000000
+#define MAX_BYTES (1ULL << 30)	// sizes beyond MAX_N / 10 only run where one array of them stays below this
+#define REPEAT 5	// minimum number of timed runs
+#define WARMUP 1	// untimed runs before the timed ones
+#define MAX_REPEAT 50	// timed runs give up here even if the interval is still wide
+#define CI_TARGET 0.01	// stop once the 95% confidence interval of the mean is within +-1%
+#define MAX_SECONDS 10.0	// or once this much time went into the timed runs
+#define SEED 1	// seed of the data generator, --seed overrides it
+//#define PRINTOUT
+//#define COUNT_COMPARISONS
+// build all files with -DSORT_STATS to also count swaps, moves, recursion depth and heap sort fallbacks
+#ifdef SORT_STATS
+#define COUNT_COMPARISONS
 #endif
 
-#if TYPE_CODE == 0
-//high cardinality int
-#define SORT_TYPE int
-#define MAX_INT 1000000000
-#define INT_GEN
-#elif TYPE_CODE == 1
-//characters
-#define SORT_TYPE char
-#define MAX_INT 256
-#define INT_GEN
-#elif TYPE_CODE == 2
-//high cardinality string
-#define SORT_TYPE char*
-#define STR_GEN
-#define MAX_STR_LEN 10
-#elif TYPE_CODE == 3
-//high cardinality double
-#define SORT_TYPE double
-#define MAX_INT 100000000
-#define DOU_GEN
-#elif TYPE_CODE == 4
-//low cardinality int
-#define SORT_TYPE int
-#define MAX_INT 10000
-#define INT_GEN
-#elif TYPE_CODE == 5
-//low cardinality int
-#define SORT_TYPE char*
-#define STR_GEN
-#define MAX_STR_LEN 2
-#elif TYPE_CODE == 6
-//high cardinality double
-#define SORT_TYPE double
-#define MAX_INT 10000
-#define DOU_GEN
-#endif
+enum Pattern { SORTED, UNSORTED, REVERSED, MOSTLY_SORTED, MOSTLY_REVERSED, KILLER, DUAL_PIVOT_KILLER,
+	ZIPF, FEW_UNIQUE, ALL_EQUAL, SAWTOOTH, ORGAN_PIPE, RANDOM_RUNS, PUSH_FRONT, PUSH_BACK, GAUSSIAN, SORTED_TAIL,
+	ANTIQSORT, PATTERNS };
 
+/* names of the patterns, as accepted by the pattern filter */
+extern const char *const pattern_names[PATTERNS];
 
-#if TYPE_CODE == 2
-#define SORT_CMP(x, y) (strcmp(x,y))
-#else
-#define SORT_CMP(x, y) (x - y)
-#endif
+/*
+the parameter of each pattern, 0 for patterns without one:
+zipf            exponent s, value of rank k is drawn with probability ~ 1 / k^s
+few-unique      number of distinct values
+sawtooth        number of ascending runs of equal length
+organ-pipe      number of ascending then descending pairs of runs
+random-runs     mean length of the ascending runs, their lengths are uniform in [1, 2 * mean]
+push-front      number of random elements in front of a sorted array
+push-back       number of random elements after a sorted array
+gaussian        standard deviation, as a fraction of the sorted range of distinct values
+sorted-tail     fraction of random elements after a sorted array
+*/
+extern double pattern_params[PATTERNS];
 
-#define BIN_NUM 100
-#define MIN_N 100000
-#define MAX_N 10000000
-#define REPEAT 5
-//#define PRINTOUT
+/* set a parameter from "pattern=value"; false if there is no such pattern */
+bool setPatternParam(const char *assignment);
+
+/* whether a --sizes list holds only element counts from 1 to INT_MAX */
+bool checkSizes(const char *list);
+
+/* element type of a benchmark array, with everything the benchmark does to its elements */
+typedef struct BenchType {
+	const char *name;
+	size_t es;
+	int max;		/* values are drawn from [0, max), for strings the size of one string buffer */
+	bool int_keys;		/* elements are plain integers, so the integer only engines apply */
+	bool strings;		/* elements point to NUL terminated strings */
+	int(*cmp) (const void *, const void *);		/* handed to the engines, counts comparisons */
+	int(*order) (const void *, const void *);	/* same order, not counted, to generate and verify */
+	void(*random) (void *e, const struct BenchType *type, PRNG *rng);
+	void(*write) (FILE *f, const void *e);	/* as text, for --export-text */
+	void(*release) (void *e);	/* frees what random allocated, NULL if nothing is */
+	bool(*intact) (const void *e, const struct BenchType *type);	/* element still whole after sorting, NULL if not checked */
+} BenchType;
+
+/* indexed by type code, the first number in the test data file names */
+#define BENCH_TYPES 12
+extern const BenchType bench_types[BENCH_TYPES];
+
+/* comma separated selections of what test() runs, NULL for everything */
+typedef struct {
+	const char *types;	/* type names or codes */
+	const char *patterns;	/* pattern names or numbers */
+	const char *sizes;	/* element counts, instead of MIN_N, 10 * MIN_N, ... MAX_N */
+	const char *routines;	/* parts of routine names */
+} BenchFilter;
+
+/* pages backing the benchmark arrays: as the system chooses, 4 KiB, transparent huge or hugetlbfs pages */
+enum BenchPages { PAGES_DEFAULT, PAGES_SMALL, PAGES_THP, PAGES_HUGETLB };
+
+extern const char *const bench_pages_names[];
+
+/* set before test(); falls back to PAGES_THP if no hugetlbfs pages are reserved */
+extern enum BenchPages bench_pages;
+
+/* test data is cached in binary td_<type>_<pattern>_<n>.bin files; also write them as .txt */
+extern bool bench_export_text;
 
-enum Pattern { SORTED, UNSORTED, REVERSED, MOSTLY_SORTED, MOSTLY_REVERSED, KILLER };
+/* seed of the data generator, recorded in the test data files and result.csv */
+extern unsigned long long bench_seed;
 
-void test();
+void test(const BenchFilter *filter);
 void testSorting(void(*sort)(void*, size_t, size_t, int(*)(const void*, const void*)),
-	SORT_TYPE* a, SORT_TYPE* copy, int min, int max, int rounds, char* name);
+	const BenchType *type, void* a, void* copy, int min, int max, int rounds, char* name);
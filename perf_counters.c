@@ -0,0 +1,106 @@
+#include "perf_counters.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+const char *const perf_counter_names[PERF_COUNTERS] = { "cycles", "instructions", "branch misses", "L1d misses",
+	"LLC misses", "dTLB misses" };
+
+#ifdef __linux__
+
+#define CACHE_READ_MISS(cache) \
+	((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct { unsigned type; unsigned long long config; } events[PERF_COUNTERS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+	{ PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+	{ PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) }
+};
+
+static int fds[PERF_COUNTERS];
+static int leader = -1;
+static bool opened = false;
+
+bool perfCountersOpen(void) {
+	if (opened) {
+		return leader >= 0;
+	}
+	opened = true;
+
+	for (int i = 0; i < PERF_COUNTERS; i++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.disabled = leader < 0;	/* the others follow the leader */
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+		if (fds[i] < 0) {
+			fprintf(stderr, "perf counter %s unavailable: %s\n", perf_counter_names[i], strerror(errno));
+		}
+		else if (leader < 0) {
+			leader = fds[i];
+		}
+	}
+
+	return leader >= 0;
+}
+
+void perfCountersStart(void) {
+	if (leader >= 0) {
+		ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+}
+
+void perfCountersStop(double values[PERF_COUNTERS]) {
+	if (leader >= 0) {
+		ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	for (int i = 0; i < PERF_COUNTERS; i++) {
+		/* value, time enabled, time running */
+		unsigned long long v[3];
+
+		values[i] = -1;
+		if (leader < 0 || fds[i] < 0 || read(fds[i], v, sizeof(v)) != sizeof(v) || v[2] == 0) {
+			continue;
+		}
+		/* scale up if the group had to share the PMU with other events */
+		values[i] = (double)v[0] * ((double)v[1] / v[2]);
+	}
+}
+
+#else
+
+bool perfCountersOpen(void) {
+	return false;
+}
+
+void perfCountersStart(void) {
+}
+
+void perfCountersStop(double values[PERF_COUNTERS]) {
+	for (int i = 0; i < PERF_COUNTERS; i++) {
+		values[i] = -1;
+	}
+}
+
+#endif
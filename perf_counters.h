@@ -0,0 +1,23 @@
+#pragma once
+/*
+Hardware performance counters around a measured call, read with Linux
+perf_event_open as one group so all counters cover the same instructions.
+Counting follows threads the measured call creates. Counters the kernel, the
+CPU or the permissions (perf_event_paranoid) do not allow read as unavailable
+and the benchmark leaves their columns empty.
+*/
+#include <stdbool.h>
+
+enum PerfCounter { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES, PERF_L1D_MISSES, PERF_LLC_MISSES,
+	PERF_DTLB_MISSES, PERF_COUNTERS };
+
+/* CSV column names, in enum order */
+extern const char *const perf_counter_names[PERF_COUNTERS];
+
+/* open the counters, once; false if none is available */
+bool perfCountersOpen(void);
+
+void perfCountersStart(void);
+
+/* stop counting; values[i] is the count, or a negative value if counter i is unavailable */
+void perfCountersStop(double values[PERF_COUNTERS]);
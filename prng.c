@@ -0,0 +1,40 @@
+#include "prng.h"
+
+void prngSeed(PRNG *rng, uint64_t seed) {
+	for (int i = 0; i < 4; i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		rng->s[i] = z ^ (z >> 31);
+	}
+}
+
+static void prngJumpBy(PRNG *rng, const uint64_t jump[4]) {
+	uint64_t s[4] = { 0, 0, 0, 0 };
+
+	for (int i = 0; i < 4; i++) {
+		for (int b = 0; b < 64; b++) {
+			if (jump[i] & (1ULL << b)) {
+				for (int j = 0; j < 4; j++) {
+					s[j] ^= rng->s[j];
+				}
+			}
+			prngNext(rng);
+		}
+	}
+	for (int j = 0; j < 4; j++) {
+		rng->s[j] = s[j];
+	}
+}
+
+void prngJump(PRNG *rng) {
+	static const uint64_t jump[4] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+		0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+	prngJumpBy(rng, jump);
+}
+
+void prngLongJump(PRNG *rng) {
+	static const uint64_t jump[4] = { 0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+		0x77710069854ee241ULL, 0x39109bb02acbe635ULL };
+	prngJumpBy(rng, jump);
+}
@@ -0,0 +1,49 @@
+#pragma once
+/*
+xoshiro256** by Blackman and Vigna, the generator of the benchmark data.
+Explicitly seeded, so a seed reproduces the data, and able to jump ahead by
+2^128 or 2^192 numbers, which gives every chunk of a parallel fill its own
+non-overlapping stream.
+*/
+#include <stdint.h>
+
+typedef struct {
+	uint64_t s[4];
+} PRNG;
+
+/* expand seed into a state with splitmix64, so similar seeds give unrelated streams */
+void prngSeed(PRNG *rng, uint64_t seed);
+
+/* advance by 2^128 numbers */
+void prngJump(PRNG *rng);
+
+/* advance by 2^192 numbers */
+void prngLongJump(PRNG *rng);
+
+static __inline uint64_t prngRotl(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+static __inline uint64_t prngNext(PRNG *rng) {
+	uint64_t *s = rng->s;
+	uint64_t result = prngRotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = prngRotl(s[3], 45);
+	return result;
+}
+
+/* uniform in [0, bound), by multiplying instead of a modulo */
+static __inline uint32_t prngBelow(PRNG *rng, uint32_t bound) {
+	return (uint32_t)(((prngNext(rng) >> 32) * bound) >> 32);
+}
+
+/* uniform in [0, 1), from the upper 53 bits */
+static __inline double prngDouble(PRNG *rng) {
+	return (prngNext(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
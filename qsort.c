@@ -1,10 +1,21 @@
 #include "qsort.h"
+#include "sort_dispatch.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+#include <stdint.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
 #define Min(X,Y) ((X) < (Y) ? (X) : (Y))
+#define Max(X,Y) ((X) > (Y) ? (X) : (Y))
 
 typedef struct {
 	size_t alloc;
@@ -17,16 +28,95 @@ typedef struct {
 } TIM_SORT_RUN_T;
 
 
-static __inline void* pick(void* a, int i, int es) {
+/*
+* With SORT_PREFETCH_DISTANCE > 0, and elements declared to point to their
+* keys by sort_pointer_keys, as with strings: the loop at p prefetches the key
+* of the element SORT_PREFETCH_DISTANCE places further in direction dir (1 or
+* -1), if that element lies in [lo, hi]. The flag belongs to the calling
+* thread; the parallel engines hand it on to their workers.
+*/
+static _Thread_local bool pointer_keys;
+
+void sort_pointer_keys(bool on) {
+	pointer_keys = on;
+}
+
+#if SORT_PREFETCH_DISTANCE > 0 && defined(__GNUC__)
+#define prefetch_pointee(p, dir, lo, hi, es) do { \
+	const char *e_ = (const char *)(p) + (dir) * (ptrdiff_t)(SORT_PREFETCH_DISTANCE * (es)); \
+	if (pointer_keys && e_ >= (const char *)(lo) && e_ <= (const char *)(hi)) \
+		__builtin_prefetch(*(char *const *)e_); \
+} while (0)
+#else
+#define prefetch_pointee(p, dir, lo, hi, es) ((void)0)
+#endif
+
+#ifdef SORT_STATS
+SORT_STATS_T sort_stats;
+
+/* nesting of recursive calls in this thread */
+static _Thread_local unsigned long long sort_stats_level;
+
+void sort_stats_reset(void) {
+	atomic_store(&sort_stats.swaps, 0);
+	atomic_store(&sort_stats.moves, 0);
+	atomic_store(&sort_stats.bytes_moved, 0);
+	atomic_store(&sort_stats.max_depth, 0);
+	atomic_store(&sort_stats.heap_fallbacks, 0);
+}
+
+static __inline void sort_stats_add(atomic_ullong *counter, unsigned long long v) {
+	atomic_fetch_add_explicit(counter, v, memory_order_relaxed);
+}
+
+static __inline void sort_stats_enter(void) {
+	unsigned long long level = ++sort_stats_level;
+	unsigned long long max = atomic_load_explicit(&sort_stats.max_depth, memory_order_relaxed);
+
+	while (level > max && !atomic_compare_exchange_weak_explicit(&sort_stats.max_depth, &max, level,
+		memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+#define sort_stats_swap(k, es) \
+	(sort_stats_add(&sort_stats.swaps, (k)), sort_stats_add(&sort_stats.bytes_moved, 2 * (k) * (es)))
+#define sort_stats_move(k, es) \
+	(sort_stats_add(&sort_stats.moves, (k)), sort_stats_add(&sort_stats.bytes_moved, (k) * (es)))
+#define sort_stats_fallback() sort_stats_add(&sort_stats.heap_fallbacks, 1)
+/* a recursive call, one level deeper */
+#define sort_stats_call(call) do { sort_stats_enter(); call; sort_stats_level--; } while (0)
+#else
+#define sort_stats_swap(k, es) ((void)0)
+#define sort_stats_move(k, es) ((void)0)
+#define sort_stats_fallback() ((void)0)
+#define sort_stats_call(call) call
+#endif
+
+/* monotonic time in nanoseconds; CLOCK_MONOTONIC_RAW is not slewed by NTP */
+double now_ns(void) {
+	struct timespec ts;
+#if defined(CLOCK_MONOTONIC_RAW)
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#elif defined(CLOCK_MONOTONIC)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	timespec_get(&ts, TIME_UTC);
+#endif
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static __inline void* pick(void* a, size_t i, size_t es) {
 	return (char*)a + i * es;
 }
 
-static __inline void assign(void* a, void* b, int es) {
+static __inline void assign(void* a, void* b, size_t es) {
+	sort_stats_move(1, es);
 	memcpy(a, b, es);
 }
 
-static __inline void swap(void* a, void* b, int es) {
+static __inline void swap(void* a, void* b, size_t es) {
 	char* pa = (char*)a, *pb = (char*)b;
+	sort_stats_swap(1, es);
 	do {
 		char tmp = *pa;
 		*pa++ = *pb;
@@ -34,11 +124,36 @@ static __inline void swap(void* a, void* b, int es) {
 	} while (--es > 0);
 }
 
+/*
+* Room for `slots` elements of es bytes held outside the array: the caller's
+* stack buffer of slots * MAX_ES bytes, or for wider elements one malloc per
+* top-level call, which scratch_free releases
+*/
+static char *scratch_alloc(char *stack, const size_t slots, const size_t es) {
+	char *scratch;
+
+	if (es <= MAX_ES) {
+		return stack;
+	}
+
+	scratch = malloc(slots * es);
+	if (scratch == NULL) {
+		fprintf(stderr, "Error allocating scratch space: need %lu bytes", (unsigned long)(slots * es));
+		exit(1);
+	}
+	return scratch;
+}
+
+static void scratch_free(char *scratch, const char *stack) {
+	if (scratch != stack) {
+		free(scratch);
+	}
+}
+
 /* Function used to do a binary search for binary insertion sort */
 static __inline size_t binary_insertion_sort_find(void *a, const void* x,
 	const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
 	size_t l, c, r;
-	char cx[MAX_ES];
 	l = 0;
 	r = size - 1;
 	c = r >> 1;
@@ -51,10 +166,8 @@ static __inline size_t binary_insertion_sort_find(void *a, const void* x,
 		return r;
 	}
 
-	assign(cx, pick(a, c, es), es);
-
 	while (1) {
-		const int val = cmp(x, cx);
+		const int val = cmp(x, pick(a, c, es));
 
 		if (val < 0) {
 			if (c - l <= 1) {
@@ -72,16 +185,15 @@ static __inline size_t binary_insertion_sort_find(void *a, const void* x,
 		}
 
 		c = l + ((r - l) >> 1);
-		assign(cx, pick(a, c, es), es);
 	}
 }
 
 /* Binary insertion sort, but knowing that the first "start" entries are sorted.  Used in timsort. */
+/* x is scratch space for one element */
 //TODO: consider pair insertion sort (used in JDK8)
 static __inline void binary_insertion_sort_start(void *a, const size_t start, const size_t size,
-	const size_t es, int(*cmp) (const void *, const void *)) {
+	const size_t es, int(*cmp) (const void *, const void *), char *x) {
 	size_t i;
-	char x[MAX_ES];
 
 	for (i = start; i < size; i++) {
 		size_t j;
@@ -108,20 +220,20 @@ static __inline void binary_insertion_sort_start(void *a, const size_t start, co
 }
 
 /* Binary insertion sort */
-static __inline void binary_insertion_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+static __inline void binary_insertion_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *),
+	char *x) {
 	/* don't bother sorting an array of size <= 1 */
 	if (size <= 1) {
 		return;
 	}
 
-	binary_insertion_sort_start(a, 1, size, es, cmp);
+	binary_insertion_sort_start(a, 1, size, es, cmp, x);
 }
 
 /* Quick sort: based on wikipedia */
 static __inline size_t quick_sort_partition(void *a, const size_t left,
 	const size_t right, const size_t pivot, const size_t es,
-	int(*cmp) (const void *, const void *)) {
-	char value[MAX_ES];
+	int(*cmp) (const void *, const void *), char *value) {
 	assign(value, pick(a, pivot, es), es);
 	size_t index = left;
 	size_t i;
@@ -150,8 +262,9 @@ static __inline size_t quick_sort_partition(void *a, const size_t left,
 	return index;
 }
 
+/* scratch holds one element, for the insertion sort or the pivot */
 static void quick_sort_recursive(void *a, const size_t left, const size_t right,
-	const size_t es, int(*cmp) (const void *, const void *)) {
+	const size_t es, int(*cmp) (const void *, const void *), char *scratch) {
 	size_t pivot;
 	size_t new_pivot;
 
@@ -160,44 +273,65 @@ static void quick_sort_recursive(void *a, const size_t left, const size_t right,
 	}
 
 	if ((right - left + 1U) < INSERTION_THRESHOLD) {
-		binary_insertion_sort(pick(a, left, es), right - left + 1U, es, cmp);
+		binary_insertion_sort(pick(a, left, es), right - left + 1U, es, cmp, scratch);
 		return;
 	}
 
 	pivot = left + ((right - left) >> 1);
 	/* this seems to perform worse by a small amount... ? */
 	/* pivot = MEDIAN(a, left, pivot, right); */
-	new_pivot = quick_sort_partition(a, left, right, pivot, es, cmp);
+	new_pivot = quick_sort_partition(a, left, right, pivot, es, cmp, scratch);
 
 	/* check for partition all equal */
 	if (new_pivot == SIZE_MAX) {
 		return;
 	}
 
-	quick_sort_recursive(a, left, new_pivot - 1U, es, cmp);
-	quick_sort_recursive(a, new_pivot + 1U, right, es, cmp);
+	sort_stats_call(quick_sort_recursive(a, left, new_pivot - 1U, es, cmp, scratch));
+	sort_stats_call(quick_sort_recursive(a, new_pivot + 1U, right, es, cmp, scratch));
 }
 
 void quick_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	char stack[MAX_ES], *scratch;
+
 	/* don't bother sorting an array of size 1 */
 	if (size <= 1) {
 		return;
 	}
 
-	quick_sort_recursive(a, 0U, size - 1U, es, cmp);
+	scratch = scratch_alloc(stack, 1, es);
+	quick_sort_recursive(a, 0U, size - 1U, es, cmp, scratch);
+	scratch_free(scratch, stack);
 }
 
 
 
-static void dual_pivot_quick_sort_recursive(void *a, const size_t left, const size_t right,
-	const size_t es, int(*cmp) (const void *, const void *)) {
+/*
+* scratch holds three elements: the pivots in the first two, the element in
+* hand in the third; a single pivot and the insertion sort use the first
+*/
+static void dual_pivot_quick_sort_recursive(void *a, size_t left, size_t right, size_t depth,
+	const size_t es, int(*cmp) (const void *, const void *), char *scratch) {
+loop:;
 	const size_t length = right - left + 1U;
 
 	// Use insertion sort on tiny arrays
 	if (length < INSERTION_THRESHOLD) {
-		binary_insertion_sort(pick(a, left, es), length, es, cmp);
+		binary_insertion_sort(pick(a, left, es), length, es, cmp, scratch);
+		return;
+	}
+
+	// Convert to heap sort if exceed depth limit
+	if (!depth) {
+		sort_stats_fallback();
+#if HEAP_SORT_ARITY == 4
+		heap_sort4_wrapper(pick(a, left, es), length, es, cmp);
+#else
+		heap_sort_wrapper(pick(a, left, es), length, es, cmp);
+#endif
 		return;
 	}
+	depth--;
 
 	// Inexpensive approximation of length / 7
 	size_t seventh = (length >> 3) + (length >> 6) + 1U;
@@ -215,7 +349,7 @@ static void dual_pivot_quick_sort_recursive(void *a, const size_t left, const si
 	size_t e4 = e3 + seventh;
 	size_t e5 = e4 + seventh;
 
-	char t[MAX_ES];
+	char *t = scratch + 2 * es;
 
 	// Sort these elements using insertion sort
 	if (cmp(pick(a, e2, es), pick(a, e1, es))<0) {
@@ -280,7 +414,7 @@ static void dual_pivot_quick_sort_recursive(void *a, const size_t left, const si
 		* These values are inexpensive approximations of the first and
 		* second terciles of the array. Note that pivot1 <= pivot2.
 		*/
-		char pivot1[MAX_ES], pivot2[MAX_ES];
+		char *pivot1 = scratch, *pivot2 = scratch + es;
 		assign(pivot1, pick(a, e2, es), es);
 		assign(pivot2, pick(a, e4, es), es);
 
@@ -318,8 +452,8 @@ static void dual_pivot_quick_sort_recursive(void *a, const size_t left, const si
 		*
 		* Pointer k is the first index of ?-part.
 		*/
-		for (int k = less - 1; ++k <= great; ) {
-			char ak[MAX_ES];
+		for (size_t k = less - 1; ++k <= great; ) {
+			char *ak = scratch + 2 * es;
 			assign(ak, pick(a, k, es), es);
 			if (cmp(ak, pivot1) < 0) { // Move a[k] to left part
 				assign(pick(a, k, es), pick(a, less, es), es);
@@ -359,9 +493,12 @@ static void dual_pivot_quick_sort_recursive(void *a, const size_t left, const si
 		assign(pick(a, right, es), pick(a, great + 1, es), es);
 		assign(pick(a, great + 1, es), pivot2, es);
 
-		// Sort left and right parts recursively, excluding known pivots
-		dual_pivot_quick_sort_recursive(a, left, less - 2, es, cmp);
-		dual_pivot_quick_sort_recursive(a, great + 2, right, es, cmp);
+		// Left and right parts, excluding known pivots
+		size_t starts[3], sizes[3];
+		starts[0] = left;
+		sizes[0] = less - 1 - left;
+		starts[2] = great + 2;
+		sizes[2] = right - great - 1;
 
 		/*
 		* If center part is too large (comprises > 4/7 of the array),
@@ -398,8 +535,8 @@ static void dual_pivot_quick_sort_recursive(void *a, const size_t left, const si
 			*
 			* Pointer k is the first index of ?-part.
 			*/
-			for (int k = less - 1; ++k <= great; ) {
-				char ak[MAX_ES];
+			for (size_t k = less - 1; ++k <= great; ) {
+				char *ak = scratch + 2 * es;
 				assign(ak, pick(a, k, es), es);
 				if (!cmp(ak, pivot1)) { // Move a[k] to left part
 					assign(pick(a, k, es), pick(a, less, es), es);
@@ -435,16 +572,31 @@ static void dual_pivot_quick_sort_recursive(void *a, const size_t left, const si
 		jump2:;
 		}
 
-		// Sort center part recursively
-		dual_pivot_quick_sort_recursive(a, less, great, es, cmp);
+		starts[1] = less;
+		sizes[1] = great + 1 - less;
 
+		/*
+		* Sort the two smaller parts recursively and iterate on the
+		* largest one, so the stack stays bounded by log(n) frames.
+		*/
+		int largest = sizes[0] >= sizes[1] ? (sizes[0] >= sizes[2] ? 0 : 2) : (sizes[1] >= sizes[2] ? 1 : 2);
+		for (int p = 0; p < 3; p++) {
+			if (p != largest && sizes[p] > 1) {
+				sort_stats_call(dual_pivot_quick_sort_recursive(a, starts[p], starts[p] + sizes[p] - 1, depth, es, cmp, scratch));
+			}
+		}
+		if (sizes[largest] > 1) {
+			left = starts[largest];
+			right = starts[largest] + sizes[largest] - 1;
+			goto loop;
+		}
 	}
 	else { // Partitioning with one pivot
 		   /*
 		   * Use the third of the five sorted elements as pivot.
 		   * This value is inexpensive approximation of the median.
 		   */
-		char pivot[MAX_ES];
+		char *pivot = scratch;
 		assign(pivot, pick(a, e3, es), es);
 
 		/*
@@ -467,11 +619,11 @@ static void dual_pivot_quick_sort_recursive(void *a, const size_t left, const si
 		*
 		* Pointer k is the first index of ?-part.
 		*/
-		for (int k = less; k <= great; ++k) {
+		for (size_t k = less; k <= great; ++k) {
 			if (!cmp(pick(a, k, es), pivot)) {
 				continue;
 			}
-			char ak[MAX_ES];
+			char *ak = scratch + 2 * es;
 			assign(ak, pick(a, k, es), es);
 			if (cmp(ak, pivot) < 0) { // Move a[k] to left part
 				assign(pick(a, k, es), pick(a, less, es), es);
@@ -504,19 +656,34 @@ static void dual_pivot_quick_sort_recursive(void *a, const size_t left, const si
 		}
 
 		/*
-		* Sort left and right parts recursively.
+		* Sort left and right parts, recursing on the smaller one.
 		* All elements from center part are equal
 		* and, therefore, already sorted.
 		*/
-		dual_pivot_quick_sort_recursive(a, left, less - 1, es, cmp);
-		dual_pivot_quick_sort_recursive(a, great + 1, right, es, cmp);
+		if (less - left <= right - great) {
+			sort_stats_call(dual_pivot_quick_sort_recursive(a, left, less - 1, depth, es, cmp, scratch));
+			left = great + 1;
+		}
+		else {
+			sort_stats_call(dual_pivot_quick_sort_recursive(a, great + 1, right, depth, es, cmp, scratch));
+			right = less - 1;
+		}
+		goto loop;
 	}
 }
 
 /* Dual-pivot quicksort implementation, based on JDK8 */
 void dual_pivot_quick_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	char stack[3 * MAX_ES], *scratch;
+
+	/* don't bother sorting an array of size 1 */
+	if (size <= 1) {
+		return;
+	}
 
-	dual_pivot_quick_sort_recursive(a, 0U, size - 1U, es, cmp);
+	scratch = scratch_alloc(stack, 3, es);
+	dual_pivot_quick_sort_recursive(a, 0U, size - 1U, 2 * log(size), es, cmp, scratch);
+	scratch_free(scratch, stack);
 }
 
 
@@ -635,6 +802,15 @@ static void tim_sort_resize(TEMP_STORAGE_T *store, const size_t new_size,
 	}
 }
 
+/*
+* comparator tim_sort_int hands to tim_sort, it marks int keys ordered by value
+* whose runs tim_sort_merge merges with the merge kernels of sort_dispatch
+*/
+static int tim_sort_int_cmp(const void *a, const void *b) {
+	const int x = *(const int *)a, y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+
 static void tim_sort_merge(void *dst, const TIM_SORT_RUN_T *stack, const int stack_curr,
 	TEMP_STORAGE_T *store, size_t es, int(*cmp) (const void *, const void *)) {
 	const size_t A = stack[stack_curr - 2].length;
@@ -642,21 +818,43 @@ static void tim_sort_merge(void *dst, const TIM_SORT_RUN_T *stack, const int sta
 	const size_t curr = stack[stack_curr - 2].start;
 	char *storage;
 	size_t i, j, k;
-	tim_sort_resize(store, min(A, B), es, cmp);
+	tim_sort_resize(store, Min(A, B), es, cmp);
 	storage = store->storage;
 
+	if (cmp == tim_sort_int_cmp) {
+		const SORT_KERNELS *kernels = sort_kernels();
+		int32_t *run = (int32_t *)dst + curr;
+
+		if (A < B) {
+			sort_stats_move(2 * A + B, es);	/* the copy of A and the merge */
+			memcpy(storage, run, A * es);
+			kernels->merge_i32((const int32_t *)storage, A, run + A, B, run);
+		}
+		else {
+			sort_stats_move(A + 2 * B, es);	/* the copy of B and the merge */
+			memcpy(storage, run + A, B * es);
+			kernels->merge_i32_backward(run, A, (const int32_t *)storage, B, run + A + B);
+		}
+
+		return;
+	}
+
 	/* left merge */
 	if (A < B) {
+		sort_stats_move(A, es);
 		memcpy(storage, pick(dst, curr, es), A * es);
 		i = 0;
 		j = curr + A;
 
 		for (k = curr; k < curr + A + B; k++) {
 			if ((i < A) && (j < curr + A + B)) {
+				/* prefetch ahead in the run that advances */
 				if (cmp(pick(storage, i, es), pick(dst, j, es)) <= 0) {
+					prefetch_pointee(pick(storage, i, es), 1, storage, pick(storage, A - 1, es), es);
 					assign(pick(dst, k, es), pick(storage, i++, es), es);
 				}
 				else {
+					prefetch_pointee(pick(dst, j, es), 1, dst, pick(dst, curr + A + B - 1, es), es);
 					assign(pick(dst, k, es), pick(dst, j++, es), es);
 				}
 			}
@@ -670,6 +868,7 @@ static void tim_sort_merge(void *dst, const TIM_SORT_RUN_T *stack, const int sta
 	}
 	else {
 		/* right merge */
+		sort_stats_move(B, es);
 		memcpy(storage, pick(dst, curr + A, es), B * es);
 		i = B;
 		j = curr + A;
@@ -678,9 +877,11 @@ static void tim_sort_merge(void *dst, const TIM_SORT_RUN_T *stack, const int sta
 		while (k-- > curr) {
 			if ((i > 0) && (j > curr)) {
 				if (cmp(pick(dst, j - 1, es), pick(storage, i - 1, es)) > 0) {
+					prefetch_pointee(pick(dst, j - 1, es), -1, pick(dst, curr, es), pick(dst, j - 1, es), es);
 					assign(pick(dst, k, es), pick(dst, --j, es), es);
 				}
 				else {
+					prefetch_pointee(pick(storage, i - 1, es), -1, storage, pick(storage, i - 1, es), es);
 					assign(pick(dst, k, es), pick(storage, --i, es), es);
 				}
 			}
@@ -768,7 +969,7 @@ static __inline int push_next(void *a,
 	TIM_SORT_RUN_T *run_stack,
 	size_t *stack_curr,
 	size_t *curr,
-	const size_t es, int(*cmp) (const void *, const void *)) {
+	const size_t es, int(*cmp) (const void *, const void *), char *x) {
 	size_t len = count_run(a, *curr, size, es, cmp);
 	size_t run = minrun;
 
@@ -777,7 +978,7 @@ static __inline int push_next(void *a,
 	}
 
 	if (run > len) {
-		binary_insertion_sort_start(pick(a, *curr, es), len, run, es, cmp);
+		binary_insertion_sort_start(pick(a, *curr, es), len, run, es, cmp, x);
 		len = run;
 	}
 
@@ -807,7 +1008,7 @@ static __inline int push_next(void *a,
 
 static __inline int compute_minrun(const uint64_t size) {
 	const int top_bit = 64 - CLZ(size);
-	const int shift = max(top_bit, 6) - 6;
+	const int shift = Max(top_bit, 6) - 6;
 	const int minrun = size >> shift;
 	const uint64_t mask = (1ULL << shift) - 1;
 
@@ -818,40 +1019,32 @@ static __inline int compute_minrun(const uint64_t size) {
 	return minrun;
 }
 
-/* implementation of tim sort */
-void tim_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+/* tim sort merging through store, which it grows as needed and frees; x is scratch space for one element */
+static void tim_sort_store(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *),
+	TEMP_STORAGE_T *store, char *x) {
 	size_t minrun;
-	TEMP_STORAGE_T _store, *store;
 	TIM_SORT_RUN_T run_stack[TIM_SORT_STACK_SIZE];
 	size_t stack_curr = 0;
 	size_t curr = 0;
 
-	/* don't bother sorting an array of size 1 */
-	if (size <= 1) {
-		return;
-	}
-
 	if (size < 64) {
-		binary_insertion_sort(a, size, es, cmp);
+		binary_insertion_sort(a, size, es, cmp, x);
+		free(store->storage);
 		return;
 	}
 
 	/* compute the minimum run length */
 	minrun = compute_minrun(size);
-	/* temporary storage for merges */
-	store = &_store;
-	store->alloc = 0;
-	store->storage = NULL;
 
-	if (!push_next(a, size, store, minrun, run_stack, &stack_curr, &curr, es, cmp)) {
+	if (!push_next(a, size, store, minrun, run_stack, &stack_curr, &curr, es, cmp, x)) {
 		return;
 	}
 
-	if (!push_next(a, size, store, minrun, run_stack, &stack_curr, &curr, es, cmp)) {
+	if (!push_next(a, size, store, minrun, run_stack, &stack_curr, &curr, es, cmp, x)) {
 		return;
 	}
 
-	if (!push_next(a, size, store, minrun, run_stack, &stack_curr, &curr, es, cmp)) {
+	if (!push_next(a, size, store, minrun, run_stack, &stack_curr, &curr, es, cmp, x)) {
 		return;
 	}
 
@@ -861,12 +1054,44 @@ void tim_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void
 			continue;
 		}
 
-		if (!push_next(a, size, store, minrun, run_stack, &stack_curr, &curr, es, cmp)) {
+		if (!push_next(a, size, store, minrun, run_stack, &stack_curr, &curr, es, cmp, x)) {
 			return;
 		}
 	}
 }
 
+/* implementation of tim sort */
+void tim_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	TEMP_STORAGE_T store;
+	char stack[MAX_ES], *x;
+
+	/* don't bother sorting an array of size 1 */
+	if (size <= 1) {
+		return;
+	}
+
+	/* temporary storage for merges */
+	store.alloc = 0;
+	store.storage = NULL;
+	x = scratch_alloc(stack, 1, es);
+	tim_sort_store(a, size, es, cmp, &store, x);
+	scratch_free(x, stack);
+}
+
+/*
+* tim sort for int keys ordered by value, the runs are merged with a bitonic
+* merge network on vector registers, see simd_merge.h
+* other element sizes go to tim_sort with the given comparator
+*/
+void tim_sort_int(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	if (es != sizeof(int32_t)) {
+		tim_sort(a, size, es, cmp);
+		return;
+	}
+
+	tim_sort(a, size, es, tim_sort_int_cmp);
+}
+
 /*
 * radix sort implementation, based on https://www.geeksforgeeks.org/radix-sort/
 * this sorting algorithm only works on integer arrays
@@ -878,13 +1103,13 @@ void radix_sort(int *dst, const size_t size) {
 	//find the maximal number to know number of digits
 	int m = dst[0];
 	for (size_t i = 1; i < size; i++) {
-		m = max(m, dst[i]);
+		m = Max(m, dst[i]);
 	}
 
 	int* output = malloc(sizeof(int)*size);
-	int count[RADIX_SORT_BASE];
+	size_t count[RADIX_SORT_BASE];
 	for (int exp = 1; m / exp > 0; exp *= RADIX_SORT_BASE) {
-		memset(count, 0, RADIX_SORT_BASE * sizeof(int));
+		memset(count, 0, sizeof(count));
 		// store count of occurrences in count[]
 		for (size_t i = 0; i < size; i++) {
 			count[(dst[i] / exp) % RADIX_SORT_BASE]++;
@@ -896,19 +1121,123 @@ void radix_sort(int *dst, const size_t size) {
 		}
 
 		// build the output array
-		for (int i = size - 1; i >= 0; i--) {
+		for (size_t i = size; i-- > 0; ) {
 			output[count[(dst[i] / exp) % RADIX_SORT_BASE] - 1] = dst[i];
 			count[(dst[i] / exp) % RADIX_SORT_BASE]--;
 		}
 
 		// copy the output array to arr[], so that arr[] now
 		// contains sorted numbers according to current digit
+		sort_stats_move(2 * size, sizeof(int));	/* the scatter above and this copy */
 		memcpy(dst, output, size * sizeof(int));
 	}
 
 	free(output);
 }
 
+/*
+* counting sort for plain integer keys, O(n + range) and no comparisons.
+* The key range is found in one pass; if the histogram would not fit in
+* COUNTING_SORT_BUDGET bytes or the range is not small compared with n,
+* the keys are handed to radix sort instead.
+*/
+static void counting_sort_char(signed char *dst, const size_t size) {
+	size_t count[256];
+	size_t i, k = 0;
+	int v;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < size; i++) {
+		count[dst[i] + 128]++;
+	}
+
+	sort_stats_move(size, 1);
+	for (v = 0; v < 256; v++) {
+		memset(dst + k, v - 128, count[v]);
+		k += count[v];
+	}
+}
+
+static const char *counting_sort_int(int *dst, const size_t size, int(*cmp) (const void *, const void *)) {
+	int lo = dst[0], hi = dst[0];
+	size_t i;
+
+	// keep the loop free of dependencies between iterations so it vectorizes
+	for (i = 1; i < size; i++) {
+		lo = dst[i] < lo ? dst[i] : lo;
+		hi = dst[i] > hi ? dst[i] : hi;
+	}
+
+	const size_t range = (size_t)((unsigned int)hi - (unsigned int)lo);
+
+	if (range >= size || (range + 1) * sizeof(size_t) > COUNTING_SORT_BUDGET) {
+		/* radix sort walks powers of the base up to the maximum and must not overflow */
+		size_t radix_limit = 1;
+		while (radix_limit <= INT_MAX / RADIX_SORT_BASE) {
+			radix_limit *= RADIX_SORT_BASE;
+		}
+
+		if (range >= radix_limit) {
+			pg_qsort(dst, size, sizeof(int), cmp);
+			return "pg_qsort";
+		}
+		/* radix sort only handles non-negative keys, so shift them down to 0 */
+		for (i = 0; i < size; i++) {
+			dst[i] = (int)((unsigned int)dst[i] - (unsigned int)lo);
+		}
+		radix_sort(dst, size);
+		for (i = 0; i < size; i++) {
+			dst[i] = (int)((unsigned int)dst[i] + (unsigned int)lo);
+		}
+		return "radix sort";
+	}
+
+	size_t *count = calloc(range + 1, sizeof(size_t));
+
+	if (count == NULL) {
+		fprintf(stderr, "Error allocating histogram for counting sort: need %lu bytes",
+			(unsigned long)((range + 1) * sizeof(size_t)));
+		exit(1);
+	}
+
+	for (i = 0; i < size; i++) {
+		count[(unsigned int)dst[i] - (unsigned int)lo]++;
+	}
+
+	size_t k = 0;
+	sort_stats_move(size, sizeof(int));
+	for (size_t v = 0; v <= range; v++) {
+		const int key = (int)((unsigned int)lo + (unsigned int)v);
+		for (size_t c = count[v]; c > 0; c--) {
+			dst[k++] = key;
+		}
+	}
+
+	free(count);
+	return "counting sort";
+}
+
+/* counting_sort, returning the name of the engine that sorted the keys */
+static const char *counting_sort_engine(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	if (es == sizeof(signed char)) {
+		if (size > 1) {
+			counting_sort_char(a, size);
+		}
+		return "counting sort";
+	}
+	if (es == sizeof(int) && size > 1) {
+		return counting_sort_int(a, size, cmp);
+	}
+
+	pg_qsort(a, size, es, cmp);
+	return "pg_qsort";
+}
+
+/* range-aware counting sort; keys must be signed char or int, anything else goes to pg_qsort */
+void counting_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	counting_sort_engine(a, size, es, cmp);
+}
+
 static char *med3(char *a, char *b, char *c,
 	int(*cmp) (const void *, const void *));
 static void swapfunc(char *, char *, size_t, int);
@@ -956,12 +1285,13 @@ swapfunc(char *a, char *b, size_t n, int swaptype)
 #define swap(a, b)						\
 	if (swaptype == 0) {					\
 		long t = *(long *)(void *)(a);			\
+		sort_stats_swap(1, es);				\
 		*(long *)(void *)(a) = *(long *)(void *)(b);	\
 		*(long *)(void *)(b) = t;			\
 	} else							\
-		swapfunc(a, b, es, swaptype)
+		(sort_stats_swap(1, es), swapfunc(a, b, es, swaptype))
 
-#define vecswap(a, b, n) if ((n) > 0) swapfunc(a, b, n, swaptype)
+#define vecswap(a, b, n) if ((n) > 0) (sort_stats_swap((n) / es, es), swapfunc(a, b, n, swaptype))
 
 static char *
 med3(char *a, char *b, char *c, int(*cmp) (const void *, const void *))
@@ -971,13 +1301,25 @@ med3(char *a, char *b, char *c, int(*cmp) (const void *, const void *))
 		: (cmp(b, c) > 0 ? b : (cmp(a, c) < 0 ? a : c));
 }
 
-/* heap sort: based on wikipedia */
+/*
+* heap sort: based on wikipedia, with bottom-up sifting.
+*
+* The textbook sift compares both children and then the parent at every
+* level, about 2 log n comparisons. Bottom-up sifting follows the larger
+* children down to a leaf (one comparison per level), climbs back up to the
+* first element not smaller than the sifted one, and rotates the path. The
+* sifted element is usually a small one taken from the end of the heap, so
+* the climb is short and the comparisons drop to about half.
+*/
 
 static inline void
 heap_shift_down(void *a, const size_t start, const size_t end,
 	int swaptype, const size_t es, int(*cmp) (const void *, const void *)) {
+	size_t path[64];
+	int depth = 0, d;
 	size_t root = start;
 
+	path[0] = start;
 	while ((root << 1) + 1 <= end) {
 		size_t child = (root << 1) + 1;
 
@@ -985,13 +1327,16 @@ heap_shift_down(void *a, const size_t start, const size_t end,
 			child++;
 		}
 
-		if (cmp((char*)a + root * es, (char*)a + child * es) < 0) {
-			swap((char*)a + root * es, (char*)a + child * es);
-			root = child;
-		}
-		else {
-			return;
-		}
+		root = child;
+		path[++depth] = child;
+	}
+
+	while (depth > 0 && cmp((char*)a + start * es, (char*)a + path[depth] * es) > 0) {
+		depth--;
+	}
+
+	for (d = 1; d <= depth; d++) {
+		swap((char*)a + path[d - 1] * es, (char*)a + path[d] * es);
 	}
 }
 
@@ -1025,8 +1370,89 @@ heap_sort(void *a, const size_t size, int swaptype, const size_t es, int(*cmp) (
 	}
 }
 
+/*
+* 4-ary variant: children of i are 4i+1 .. 4i+4, so the heap is half as deep
+* and the children of a node are adjacent in memory, which costs one more
+* comparison per level but touches fewer cache lines on large heaps.
+*/
+static inline void
+heap_shift_down4(void *a, const size_t start, const size_t end,
+	int swaptype, const size_t es, int(*cmp) (const void *, const void *)) {
+	size_t path[64];
+	int depth = 0, d;
+	size_t root = start;
+
+	path[0] = start;
+	while ((root << 2) + 1 <= end) {
+		size_t first = (root << 2) + 1;
+		size_t last = Min(first + 3, end);
+		size_t child = first, c;
+
+		for (c = first + 1; c <= last; c++) {
+			if (cmp((char*)a + child * es, (char*)a + c * es) < 0) {
+				child = c;
+			}
+		}
+
+		root = child;
+		path[++depth] = child;
+	}
+
+	while (depth > 0 && cmp((char*)a + start * es, (char*)a + path[depth] * es) > 0) {
+		depth--;
+	}
+
+	for (d = 1; d <= depth; d++) {
+		swap((char*)a + path[d - 1] * es, (char*)a + path[d] * es);
+	}
+}
+
+static inline void
+heap_sort4(void *a, const size_t size, int swaptype, const size_t es, int(*cmp) (const void *, const void *)) {
+
+	size_t start, end;
+	/* don't bother sorting an array of size <= 1 */
+	if (size <= 1) {
+		return;
+	}
+
+	end = size - 1;
+
+	/* heapify */
+	start = (end - 1) >> 2;
+	while (1) {
+		heap_shift_down4(a, start, end, swaptype, es, cmp);
+
+		if (start == 0) {
+			break;
+		}
+
+		start--;
+	}
+
+	while (end > 0) {
+		swap((char*)a + end * es, (char*)a);
+		heap_shift_down4(a, 0, end - 1, swaptype, es, cmp);
+		end--;
+	}
+}
+
+/* heap used when quicksort exceeds its depth limit */
+#if HEAP_SORT_ARITY == 4
+#define heap_sort_fallback heap_sort4
+#else
+#define heap_sort_fallback heap_sort
+#endif
+
+/*
+* Ranges of at least sample_min elements take the median of about sqrt(n)
+* evenly spaced elements as pivot instead of the ninther. The sample is
+* sorted at the front of the range, then its lower half stays behind the
+* pivot and its upper half is moved to the end, so partitioning starts
+* with both halves already on their side and never compares them again.
+*/
 static void
-pg_qsort_recursive(void *a, size_t n, size_t depth, int swaptype, size_t es, int(*cmp) (const void *, const void *))
+pg_qsort_recursive(void *a, size_t n, size_t depth, size_t sample_min, int swaptype, size_t es, int(*cmp) (const void *, const void *))
 {
 	char	   *pa,
 		*pb,
@@ -1062,32 +1488,56 @@ loop:
 		return;
 	// convert to heap sort if exceed depth limit
 	if (!depth) {
-		heap_sort(a, n, swaptype, es, cmp);
+		sort_stats_fallback();
+		heap_sort_fallback(a, n, swaptype, es, cmp);
 		return;
 	}
 
-	pm = (char *)a + (n / 2) * es;
-	if (n > 7)
+	if (n >= sample_min)
 	{
-		pl = (char *)a;
-		pn = (char *)a + (n - 1) * es;
-		if (n > 40)
+		size_t		s = (size_t)sqrt((double)n) | 1,
+			step = n / s,
+			m = s / 2,
+			u = s - 1 - m;
+
+		for (size_t i = 1; i < s; i++)
+			swap((char *)a + i * es, (char *)a + i * step * es);
+		sort_stats_call(pg_qsort_recursive(a, s, depth - 1, sample_min, swaptype, es, cmp));
+		swap(a, (char *)a + m * es);
+		vecswap((char *)a + (m + 1) * es, (char *)a + (n - u) * es, u * es);
+		pa = (char *)a + es;
+		pb = (char *)a + (m + 1) * es;
+		pc = (char *)a + (n - 1 - u) * es;
+		pd = (char *)a + (n - 1) * es;
+	}
+	else
+	{
+		pm = (char *)a + (n / 2) * es;
+		if (n > 7)
 		{
-			size_t		d = (n / 8) * es;
+			pl = (char *)a;
+			pn = (char *)a + (n - 1) * es;
+			if (n > 40)
+			{
+				size_t		d = (n / 8) * es;
 
-			pl = med3(pl, pl + d, pl + 2 * d, cmp);
-			pm = med3(pm - d, pm, pm + d, cmp);
-			pn = med3(pn - 2 * d, pn - d, pn, cmp);
+				pl = med3(pl, pl + d, pl + 2 * d, cmp);
+				pm = med3(pm - d, pm, pm + d, cmp);
+				pn = med3(pn - 2 * d, pn - d, pn, cmp);
+			}
+			pm = med3(pl, pm, pn, cmp);
 		}
-		pm = med3(pl, pm, pn, cmp);
+		swap(a, pm);
+		pa = pb = (char *)a + es;
+		pc = pd = (char *)a + (n - 1) * es;
 	}
-	swap(a, pm);
-	pa = pb = (char *)a + es;
-	pc = pd = (char *)a + (n - 1) * es;
 	for (;;)
 	{
-		while (pb <= pc && (r = cmp(pb, a)) <= 0)
+		while (pb <= pc)
 		{
+			prefetch_pointee(pb, 1, pb, pc, es);
+			if ((r = cmp(pb, a)) > 0)
+				break;
 			if (r == 0)
 			{
 				swap(pa, pb);
@@ -1095,8 +1545,11 @@ loop:
 			}
 			pb += es;
 		}
-		while (pb <= pc && (r = cmp(pc, a)) >= 0)
+		while (pb <= pc)
 		{
+			prefetch_pointee(pc, -1, pb, pc, es);
+			if ((r = cmp(pc, a)) < 0)
+				break;
 			if (r == 0)
 			{
 				swap(pc, pd);
@@ -1121,7 +1574,7 @@ loop:
 	{
 		/* Recurse on left partition, then iterate on right partition */
 		if (d1 > es)
-			pg_qsort_recursive(a, d1 / es, depth - 1, swaptype, es, cmp);
+			sort_stats_call(pg_qsort_recursive(a, d1 / es, depth - 1, sample_min, swaptype, es, cmp));
 		if (d2 > es)
 		{
 			/* Iterate rather than recurse to save stack space */
@@ -1136,7 +1589,7 @@ loop:
 	{
 		/* Recurse on right partition, then iterate on left partition */
 		if (d2 > es)
-			pg_qsort_recursive(pn - d2, d2 / es, depth - 1, swaptype, es, cmp);
+			sort_stats_call(pg_qsort_recursive(pn - d2, d2 / es, depth - 1, sample_min, swaptype, es, cmp));
 		if (d1 > es)
 		{
 			/* Iterate rather than recurse to save stack space */
@@ -1149,14 +1602,83 @@ loop:
 }
 
 
+/*
+* Linear-time check for input made of a few long runs, such as a scan of a
+* DESC index. count_run reverses strictly descending runs in place; returns
+* the number of runs, 1 if the input is sorted now, or 0 once there are more
+* than PG_QSORT_MAX_RUNS, which random input reaches after about
+* 2 * PG_QSORT_MAX_RUNS comparisons.
+*/
+static size_t
+pg_qsort_runs(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	size_t curr = 0, runs = 0;
+
+	while (curr < size) {
+		if (++runs > PG_QSORT_MAX_RUNS) {
+			return 0;
+		}
+		curr += count_run(a, curr, size, es, cmp);
+	}
+
+	return runs;
+}
+
 void
 pg_qsort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
-	int swaptype, presorted = 1;
-	char* pm, pl;
+	int swaptype;
 	SWAPINIT(a, es);
-	pg_qsort_recursive(a, size, 2 * log(size), swaptype, es, cmp);
+	if (size >= 7 && pg_qsort_runs(a, size, es, cmp) == 1)
+		return;
+	pg_qsort_recursive(a, size, 2 * log(size), SIZE_MAX, swaptype, es, cmp);
 };
 
+/*
+* Finish an input pg_qsort_runs found `runs` runs in: merge a few with tim
+* sort, which needs at most size / 2 elements of temporary memory, allocated
+* up front; without it, or with runs == 0, the input is left to the in-place
+* sort.
+*/
+static void
+pg_qsort_merge(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *), size_t runs) {
+	int swaptype;
+
+	if (runs == 1)
+		return;
+	if (runs > 1) {
+		TEMP_STORAGE_T store;
+		char stack[MAX_ES], *x;
+
+		/* no merge takes more than the shorter of two runs */
+		store.alloc = size / 2;
+		store.storage = malloc(store.alloc * es);
+		if (store.storage != NULL) {
+			x = scratch_alloc(stack, 1, es);
+			tim_sort_store(a, size, es, cmp, &store, x);
+			scratch_free(x, stack);
+			return;
+		}
+	}
+
+	SWAPINIT(a, es);
+	pg_qsort_recursive(a, size, 2 * log(size), SIZE_MAX, swaptype, es, cmp);
+}
+
+/* pg_qsort that merges inputs of a few runs with tim sort instead of partitioning them */
+void
+pg_qsort_merge_runs(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	pg_qsort_merge(a, size, es, cmp, size >= 7 ? pg_qsort_runs(a, size, es, cmp) : 0);
+}
+
+/* pg_qsort with median of sqrt(n) pivots on ranges of PG_QSORT_SAMPLE_MIN_N or more */
+void
+pg_qsort_sampled(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	int swaptype;
+	SWAPINIT(a, es);
+	if (size >= 7 && pg_qsort_runs(a, size, es, cmp) == 1)
+		return;
+	pg_qsort_recursive(a, size, 2 * log(size), PG_QSORT_SAMPLE_MIN_N, swaptype, es, cmp);
+}
+
 
 static void
 pg_qsort_once_recursive(void *a, size_t n, size_t depth, int swaptype, size_t es, int(*cmp) (const void *, const void *))
@@ -1170,8 +1692,7 @@ pg_qsort_once_recursive(void *a, size_t n, size_t depth, int swaptype, size_t es
 		*pn;
 	size_t		d1,
 		d2;
-	int			r,
-		presorted;
+	int			r;
 
 loop:
 	if (n < 7)
@@ -1184,7 +1705,8 @@ loop:
 	}
 	// convert to heap sort if exceed depth limit
 	if (!depth) {
-		heap_sort(a, n, swaptype, es, cmp);
+		sort_stats_fallback();
+		heap_sort_fallback(a, n, swaptype, es, cmp);
 		return;
 	}
 
@@ -1243,7 +1765,7 @@ loop:
 	{
 		/* Recurse on left partition, then iterate on right partition */
 		if (d1 > es)
-			pg_qsort_once_recursive(a, d1 / es, depth - 1, swaptype, es, cmp);
+			sort_stats_call(pg_qsort_once_recursive(a, d1 / es, depth - 1, swaptype, es, cmp));
 		if (d2 > es)
 		{
 			/* Iterate rather than recurse to save stack space */
@@ -1258,7 +1780,7 @@ loop:
 	{
 		/* Recurse on right partition, then iterate on left partition */
 		if (d2 > es)
-			pg_qsort_once_recursive(pn - d2, d2 / es, depth - 1, swaptype, es, cmp);
+			sort_stats_call(pg_qsort_once_recursive(pn - d2, d2 / es, depth - 1, swaptype, es, cmp));
 		if (d1 > es)
 		{
 			/* Iterate rather than recurse to save stack space */
@@ -1274,7 +1796,7 @@ loop:
 void
 pg_qsort_once(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
 	int swaptype, presorted = 1;
-	char* pm, pl;
+	char *pm, *pl;
 	SWAPINIT(a, es);
 	if (size < 7)
 	{
@@ -1297,18 +1819,183 @@ pg_qsort_once(void *a, const size_t size, const size_t es, int(*cmp) (const void
 		return;
 	pg_qsort_once_recursive(a, size, 2 * log(size), swaptype, es, cmp);
 };
+
 /*
-* qsort comparator wrapper for strcmp.
+* Number of leading elements of the sorted a[0..k) that are not greater
+* than x, found by galloping back from a[k - 1] and then binary searching.
 */
-int
-pg_qsort_strcmp(const void *a, const void *b)
-{
-	return strcmp(*(const char *const *)a, *(const char *const *)b);
-}
+static size_t
+gallop_upper_bound(char *a, size_t k, const void *x, const size_t es, int(*cmp) (const void *, const void *)) {
+	size_t lo = 0, hi = k, step = 1;
+
+	/* invariant: everything in a[hi..k) is greater than x */
+	while (step <= hi) {
+		if (cmp(a + (hi - step) * es, x) <= 0) {
+			lo = hi - step + 1;
+			break;
+		}
+		hi -= step;
+		step <<= 1;
+	}
+
+	while (lo < hi) {
+		size_t mid = lo + ((hi - lo) >> 1);
+		if (cmp(a + mid * es, x) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
+	return lo;
+}
 
+/*
+* Repair mode for nearly sorted input. Input made of a few long runs, such as
+* the shuffled bins of MOSTLY_SORTED, has most of its elements out of place
+* relative to any one sorted subsequence, so pg_qsort_runs looks for those
+* first and they are merged as they are.
+*
+* Otherwise one linear pass compacts the longest greedily found
+* non-decreasing subsequence to the front and moves the elements breaking
+* monotonicity into a side buffer. The side buffer is sorted and merged back
+* from the end, galloping over the kept elements. When a descent is found
+* the kept element it undercuts goes out as well, so a single stray large
+* value costs two extractions instead of everything after it. If more than
+* size / PG_QSORT_REPAIR_FRACTION elements are out of place, the input goes
+* to pg_qsort instead.
+*/
 void
-old_pg_qsort(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *))
+pg_qsort_repair(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	char *base = (char *)a;
+	const size_t cap = size / PG_QSORT_REPAIR_FRACTION;
+	size_t kept = 0, m = 0, i, runs;
+	char *side;
+
+	/* a few runs; stray elements make more runs than that after a short prefix */
+	runs = size >= 7 ? pg_qsort_runs(a, size, es, cmp) : 0;
+	if (runs > 0) {
+		pg_qsort_merge(a, size, es, cmp, runs);
+		return;
+	}
+
+	if (cap < 2 || (side = malloc(cap * es)) == NULL) {
+		pg_qsort(a, size, es, cmp);
+		return;
+	}
+
+	/* invariant: base[0..kept) is sorted and i - kept == m */
+	for (i = 0; i < size; i++) {
+		char *pi = base + i * es;
+
+		if (kept == 0 || cmp(base + (kept - 1) * es, pi) <= 0) {
+			if (kept != i) {
+				sort_stats_move(1, es);
+				memcpy(base + kept * es, pi, es);
+			}
+			kept++;
+			continue;
+		}
+
+		if (m + 2 > cap) {
+			/* too many outliers, put them back into the gap and sort everything */
+			sort_stats_move(m, es);
+			memcpy(base + kept * es, side, m * es);
+			free(side);
+			pg_qsort(a, size, es, cmp);
+			return;
+		}
+
+		sort_stats_move(2, es);
+		memcpy(side + m++ * es, pi, es);
+		kept--;
+		memcpy(side + m++ * es, base + kept * es, es);
+	}
+
+	pg_qsort(side, m, es, cmp);
+
+	/* merge from the back: the kept elements move up by the outliers still to place */
+	while (m > 0) {
+		const char *x = side + (m - 1) * es;
+		size_t p = gallop_upper_bound(base, kept, x, es, cmp);
+		size_t cnt = kept - p;
+
+		sort_stats_move(cnt + 1, es);
+		memmove(base + (p + m) * es, base + p * es, cnt * es);
+		kept = p;
+		m--;
+		memcpy(base + (kept + m) * es, x, es);
+	}
+
+	free(side);
+}
+
+/* comparison of the elements pg_qsort_indirect sorts pointers to */
+static _Thread_local int(*indirect_cmp) (const void *, const void *);
+
+static int
+indirect_pointer_cmp(const void *a, const void *b) {
+	return indirect_cmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+* pg_qsort on pointers to the elements, then every element is moved once
+* into a buffer in pointer order and the buffer copied back. Swaps move a
+* pointer instead of es bytes, at the price of a pointer chase per
+* comparison and two passes over the elements; elements no wider than a
+* pointer are sorted directly.
+*/
+void
+pg_qsort_indirect(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	int(*outer) (const void *, const void *) = indirect_cmp;
+	char **ptr;
+	char *buf;
+	size_t i;
+
+	if (es <= sizeof(char *) || size < 2) {
+		pg_qsort(a, size, es, cmp);
+		return;
+	}
+
+	ptr = malloc(size * sizeof(char *));
+	buf = malloc(size * es);
+	if (!ptr || !buf) {
+		fprintf(stderr, "Error allocating temporary storage for indirect sort: need %lu bytes",
+			(unsigned long)(size * (sizeof(char *) + es)));
+		exit(1);
+	}
+
+	for (i = 0; i < size; i++)
+		ptr[i] = (char *)a + i * es;
+
+	bool outer_keys = pointer_keys;
+
+	indirect_cmp = cmp;
+	pointer_keys = true;
+	pg_qsort(ptr, size, sizeof(char *), indirect_pointer_cmp);
+	indirect_cmp = outer;
+	pointer_keys = outer_keys;
+
+	for (i = 0; i < size; i++)
+		memcpy(buf + i * es, ptr[i], es);
+	memcpy(a, buf, size * es);
+	sort_stats_move(2 * size, es);
+
+	free(ptr);
+	free(buf);
+}
+
+/*
+* qsort comparator wrapper for strcmp.
+*/
+int
+pg_qsort_strcmp(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+
+void
+old_pg_qsort(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *))
 {
 	char	   *pa,
 		*pb,
@@ -1398,7 +2085,7 @@ loop:SWAPINIT(a, es);
 	{
 		/* Recurse on left partition, then iterate on right partition */
 		if (d1 > es)
-			old_pg_qsort(a, d1 / es, es, cmp);
+			sort_stats_call(old_pg_qsort(a, d1 / es, es, cmp));
 		if (d2 > es)
 		{
 			/* Iterate rather than recurse to save stack space */
@@ -1412,7 +2099,7 @@ loop:SWAPINIT(a, es);
 	{
 		/* Recurse on right partition, then iterate on left partition */
 		if (d2 > es)
-			old_pg_qsort(pn - d2, d2 / es, es, cmp);
+			sort_stats_call(old_pg_qsort(pn - d2, d2 / es, es, cmp));
 		if (d1 > es)
 		{
 			/* Iterate rather than recurse to save stack space */
@@ -1513,7 +2200,7 @@ loop:SWAPINIT(a, es);
 	{
 		/* Recurse on left partition, then iterate on right partition */
 		if (d1 > es)
-			rand_pg_qsort(a, d1 / es, es, cmp);
+			sort_stats_call(rand_pg_qsort(a, d1 / es, es, cmp));
 		if (d2 > es)
 		{
 			/* Iterate rather than recurse to save stack space */
@@ -1527,7 +2214,7 @@ loop:SWAPINIT(a, es);
 	{
 		/* Recurse on right partition, then iterate on left partition */
 		if (d2 > es)
-			rand_pg_qsort(pn - d2, d2 / es, es, cmp);
+			sort_stats_call(rand_pg_qsort(pn - d2, d2 / es, es, cmp));
 		if (d1 > es)
 		{
 			/* Iterate rather than recurse to save stack space */
@@ -1543,4 +2230,1324 @@ void heap_sort_wrapper(void *a, const size_t size, const size_t es, int(*cmp) (c
 	int swaptype;
 	SWAPINIT(a, es);
 	heap_sort(a, size, swaptype, es, cmp);
-}
\ No newline at end of file
+}
+
+void heap_sort4_wrapper(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	int swaptype;
+	SWAPINIT(a, es);
+	heap_sort4(a, size, swaptype, es, cmp);
+}
+
+/*
+* Adaptive dispatcher: look at PG_SORT_AUTO_SAMPLE evenly spaced elements and
+* pick the engine that suits the data.
+*
+*   - nearly sorted or nearly reversed samples go to tim sort, which finds
+*     the runs (reversing descending ones) and merges them
+*   - integer keys with at least PG_SORT_AUTO_DUPLICATES of the sample
+*     repeated go to counting sort, which finds the exact key range and falls
+*     back to radix sort or pg_qsort when it is wide; the hook gets the engine
+*     that actually sorted
+*   - everything else goes to pg_qsort, whose fat partition and depth limit
+*     keep it O(n log n), with many duplicates of opaque keys as well
+*/
+pg_sort_auto_hook_type pg_sort_auto_hook = NULL;
+
+static void pg_sort_auto_sample(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *),
+	PG_SORT_AUTO_STATS *stats) {
+	const size_t m = PG_SORT_AUTO_SAMPLE;
+	const size_t step = n / m;
+	size_t descents = 0, inversions = 0, duplicates = 0;
+	size_t i, j;
+	char *sample = malloc(m * es);
+
+	if (sample == NULL) {
+		fprintf(stderr, "Error allocating sample for pg_sort_auto: need %lu bytes",
+			(unsigned long)(m * es));
+		exit(1);
+	}
+
+	for (i = 0; i < m; i++) {
+		char *p = pick(a, i * step, es);
+
+		/* run structure: is the sampled element followed by a smaller one? */
+		if (cmp(p, p + es) > 0) {
+			descents++;
+		}
+
+		memcpy(sample + i * es, p, es);
+	}
+
+	/* global order: inversions among the spaced sample */
+	for (i = 0; i < m; i++) {
+		for (j = i + 1; j < m; j++) {
+			if (cmp(sample + i * es, sample + j * es) > 0) {
+				inversions++;
+			}
+		}
+	}
+
+	/* cardinality: sampled elements equal to their predecessor once sorted */
+	pg_qsort(sample, m, es, cmp);
+	for (i = 1; i < m; i++) {
+		if (cmp(sample + (i - 1) * es, sample + i * es) == 0) {
+			duplicates++;
+		}
+	}
+
+	stats->sample = m;
+	stats->descents = (double)descents / m;
+	stats->inversions = (double)inversions / (m * (m - 1) / 2);
+	stats->duplicates = (double)duplicates / m;
+	free(sample);
+}
+
+static void pg_sort_auto_keyed(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *),
+	SORT_KEY_KIND key) {
+	PG_SORT_AUTO_STATS stats;
+
+	memset(&stats, 0, sizeof(stats));
+	stats.n = n;
+	stats.es = es;
+	stats.key = key;
+
+	if (key == SORT_KEY_INT && es != sizeof(signed char) && es != sizeof(int)) {
+		stats.key = SORT_KEY_OPAQUE;
+	}
+
+	if (n >= PG_SORT_AUTO_MIN_N) {
+		pg_sort_auto_sample(a, n, es, cmp, &stats);
+	}
+
+	if (stats.sample && (stats.descents <= 1.0 / 16 || stats.descents >= 15.0 / 16 ||
+		stats.inversions <= 1.0 / 32 || stats.inversions >= 31.0 / 32)) {
+		tim_sort(a, n, es, cmp);
+		stats.engine = "tim sort";
+	}
+	else if (stats.sample && stats.key == SORT_KEY_INT && stats.duplicates >= PG_SORT_AUTO_DUPLICATES) {
+		stats.engine = counting_sort_engine(a, n, es, cmp);
+	}
+	else {
+		pg_qsort(a, n, es, cmp);
+		stats.engine = "pg_qsort";
+	}
+
+	if (pg_sort_auto_hook != NULL) {
+		pg_sort_auto_hook(&stats);
+	}
+}
+
+/* adaptive sort for keys only known through cmp */
+void pg_sort_auto(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *)) {
+	pg_sort_auto_keyed(a, n, es, cmp, SORT_KEY_OPAQUE);
+}
+
+/* adaptive sort for plain signed char or int keys ordered by value */
+void pg_sort_auto_int(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *)) {
+	pg_sort_auto_keyed(a, n, es, cmp, SORT_KEY_INT);
+}
+
+/* number of threads a parallel engine should use for n elements */
+static int sort_threads(size_t n, size_t parallel_min_n) {
+	long threads = SORT_THREADS;
+
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (n < parallel_min_n || threads < 1) {
+		return 1;
+	}
+
+	return (int)Min(threads, SORT_MAX_THREADS);
+}
+
+/*
+* Start workers 1 .. threads - 1 on tasks of task_size bytes each and return
+* how many threads run, the caller included: creation stops at the first
+* failure and the caller shares the work out among the threads it got.
+*/
+static int sort_threads_create(pthread_t *ids, int threads, void *(*worker) (void *), void *tasks, size_t task_size) {
+	int t;
+
+	for (t = 1; t < threads; t++) {
+		if (pthread_create(&ids[t], NULL, worker, (char *)tasks + t * task_size) != 0) {
+			break;
+		}
+	}
+	return t;
+}
+
+/* workers from sort_threads_create wait here until the caller knows how many started */
+static void sort_threads_wait(atomic_int *go) {
+	while (!atomic_load(go)) {
+		sched_yield();
+	}
+}
+
+/*
+* In-place parallel super scalar sample sort, after IPS4o (Axtmann, Witt,
+* Ferizovic and Sanders, "In-place Parallel Super Scalar Samplesort").
+*
+* Each level splits the range into up to IPS4O_MAX_BUCKETS buckets:
+*
+*   1. sampling: an oversampled random sample is sorted and every alpha-th
+*      element becomes a splitter; duplicate splitters switch on equality
+*      buckets, which are never recursed into
+*   2. local classification: every thread walks its stripe, finds the bucket
+*      of each element by descending an implicit (Eytzinger) search tree and
+*      collects it in a one block buffer per bucket; full buffers are written
+*      back to the start of the stripe
+*   3. block permutation: the blocks are moved to their bucket in place,
+*      each bucket keeping an atomic pair of write and read block pointers
+*   4. cleanup: the partial blocks at bucket boundaries and the contents of
+*      the buffers are written to their final places
+*
+* Extra memory is one block per bucket and thread, independent of n. The
+* buckets are then sorted by the threads, recursively and sequentially.
+*/
+typedef struct {
+	char *buffers;		/* one block per bucket */
+	size_t *fill;		/* elements buffered per bucket */
+	size_t *counts;		/* elements classified per bucket */
+	char *swap[2];		/* blocks in flight during the permutation */
+	char *overflow;		/* the block that would stick out of the range */
+	char *splitters;	/* sorted splitters, padded to k - 1 */
+	char *tree;			/* the same splitters in Eytzinger order, 1-based */
+	size_t begin, end;	/* stripe of the range, in elements */
+	size_t full;		/* full blocks written at the start of the stripe */
+} IPS4O_LOCAL;
+
+typedef struct {
+	char *a;
+	size_t n, es;
+	int(*cmp) (const void *, const void *);
+	int threads;
+	IPS4O_LOCAL *local;
+	size_t block;		/* elements per block */
+	int log_k, k, buckets;
+	bool equal_buckets;
+	const char *splitters, *tree;
+	size_t bucket_start[IPS4O_MAX_BUCKETS + 1];
+	size_t bucket_block[IPS4O_MAX_BUCKETS + 1];	/* first block of each bucket */
+	_Atomic uint64_t wr[IPS4O_MAX_BUCKETS];		/* write block << 32 | read block */
+	atomic_int pending[IPS4O_MAX_BUCKETS];		/* blocks being read per bucket */
+	char *overflow;
+	pthread_barrier_t barrier;
+	atomic_size_t next_bucket;
+	atomic_int go;		/* set once the thread count is known */
+	bool pointer_keys;	/* the caller's sort_pointer_keys */
+} IPS4O_SHARED;
+
+static void ips4o_sequential(char *a, size_t n, size_t es, int(*cmp) (const void *, const void *),
+	IPS4O_LOCAL *local, size_t depth);
+
+static void ips4o_local_init(IPS4O_LOCAL *local, size_t es) {
+	size_t block = Max(IPS4O_BLOCK_BYTES / es, 1);
+	size_t bytes = (IPS4O_MAX_BUCKETS + 3) * block * es + 2 * IPS4O_MAX_BUCKETS * es;
+	char *mem = malloc(bytes);
+	size_t *sizes = malloc(2 * IPS4O_MAX_BUCKETS * sizeof(size_t));
+
+	if (mem == NULL || sizes == NULL) {
+		fprintf(stderr, "Error allocating block buffers for ips4o sort: need %lu bytes",
+			(unsigned long)bytes);
+		exit(1);
+	}
+
+	local->buffers = mem;
+	local->swap[0] = mem + IPS4O_MAX_BUCKETS * block * es;
+	local->swap[1] = local->swap[0] + block * es;
+	local->overflow = local->swap[1] + block * es;
+	local->splitters = local->overflow + block * es;
+	local->tree = local->splitters + IPS4O_MAX_BUCKETS * es;
+	local->fill = sizes;
+	local->counts = sizes + IPS4O_MAX_BUCKETS;
+}
+
+static void ips4o_local_free(IPS4O_LOCAL *local) {
+	free(local->buffers);
+	free(local->fill);
+}
+
+static void ips4o_barrier(IPS4O_SHARED *sh) {
+	if (sh->threads > 1) {
+		pthread_barrier_wait(&sh->barrier);
+	}
+}
+
+/* bucket of x: descend the tree without branching on the comparisons */
+static __inline int ips4o_classify(const IPS4O_SHARED *sh, const void *x) {
+	size_t b = 1;
+
+	for (int l = 0; l < sh->log_k; l++) {
+		b = 2 * b + (sh->cmp(sh->tree + b * sh->es, x) < 0);
+	}
+	b -= sh->k;
+
+	if (sh->equal_buckets) {
+		b = 2 * b + (b < (size_t)sh->k - 1 && !sh->cmp(x, sh->splitters + b * sh->es));
+	}
+
+	return (int)b;
+}
+
+/* lay out the sorted splitters as a complete search tree, in-order */
+static void ips4o_build_tree(char *tree, const char *splitters, size_t i, size_t k, size_t *next, size_t es) {
+	if (i >= k) {
+		return;
+	}
+
+	ips4o_build_tree(tree, splitters, 2 * i, k, next, es);
+	memcpy(tree + i * es, splitters + (*next)++ * es, es);
+	ips4o_build_tree(tree, splitters, 2 * i + 1, k, next, es);
+}
+
+/* step 1: draw the sample to the front of the range and choose the splitters */
+static void ips4o_sample(IPS4O_SHARED *sh) {
+	char *a = sh->a;
+	const size_t n = sh->n, es = sh->es;
+	IPS4O_LOCAL *local = &sh->local[0];
+	int swaptype;
+	int log_k = 2;
+	uint64_t state = n * 0x9E3779B97F4A7C15ULL | 1;
+
+	SWAPINIT(a, es);
+
+	while (log_k < IPS4O_LOG_BUCKETS && (n >> log_k) > IPS4O_BASE_CASE_N) {
+		log_k++;
+	}
+
+	size_t k = (size_t)1 << log_k;
+	size_t alpha = Max((size_t)(0.2 * log2((double)n)), 1);
+	size_t m = alpha * k - 1;
+
+	for (size_t i = 0; i < m; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		swap(a + i * es, a + (i + state % (n - i)) * es);
+	}
+	pg_qsort(a, m, es, sh->cmp);
+
+	/* every alpha-th sample element, without repeats */
+	size_t unique = 0;
+	for (size_t i = 1; i < k; i++) {
+		char *s = a + (i * alpha - 1) * es;
+
+		if (unique == 0 || sh->cmp(local->splitters + (unique - 1) * es, s) != 0) {
+			memcpy(local->splitters + unique++ * es, s, es);
+		}
+	}
+
+	sh->equal_buckets = unique < k - 1;
+	if (sh->equal_buckets) {
+		/* two buckets per splitter have to fit in IPS4O_MAX_BUCKETS */
+		while (2 * (unique + 1) > IPS4O_MAX_BUCKETS) {
+			for (size_t i = 0; i < unique / 2; i++) {
+				memcpy(local->splitters + i * es, local->splitters + (2 * i + 1) * es, es);
+			}
+			unique /= 2;
+		}
+		for (log_k = 1, k = 2; k < unique + 1; k *= 2) {
+			log_k++;
+		}
+	}
+
+	/* pad with the largest splitter so the tree is complete */
+	for (size_t i = unique; i < k - 1; i++) {
+		memcpy(local->splitters + i * es, local->splitters + (unique - 1) * es, es);
+	}
+
+	size_t next = 0;
+	ips4o_build_tree(local->tree, local->splitters, 1, k, &next, es);
+
+	sh->log_k = log_k;
+	sh->k = (int)k;
+	sh->buckets = sh->equal_buckets ? 2 * (int)k - 1 : (int)k;
+	sh->splitters = local->splitters;
+	sh->tree = local->tree;
+}
+
+/* step 2: classify the stripe, writing full blocks back to its start */
+static void ips4o_classify_stripe(IPS4O_SHARED *sh, IPS4O_LOCAL *local) {
+	char *a = sh->a;
+	const size_t es = sh->es, block = sh->block;
+	size_t w = local->begin;
+
+	memset(local->fill, 0, sh->buckets * sizeof(size_t));
+	memset(local->counts, 0, sh->buckets * sizeof(size_t));
+
+	for (size_t i = local->begin; i < local->end; i++) {
+		char *x = a + i * es;
+		int b = ips4o_classify(sh, x);
+		char *buffer = local->buffers + b * block * es;
+
+		sort_stats_move(1, es);
+		memcpy(buffer + local->fill[b] * es, x, es);
+		if (++local->fill[b] == block) {
+			sort_stats_move(block, es);
+			memcpy(a + w * es, buffer, block * es);
+			w += block;
+			local->fill[b] = 0;
+			local->counts[b] += block;
+		}
+	}
+
+	for (int b = 0; b < sh->buckets; b++) {
+		local->counts[b] += local->fill[b];
+	}
+	local->full = (w - local->begin) / block;
+}
+
+/*
+* Between steps 2 and 3: compute the bucket boundaries and gather the full
+* blocks at the front of the range, so that every bucket's share of the
+* block grid starts with its unprocessed blocks. Only blocks behind the
+* stripes' empty tails move, at most one block per bucket and thread.
+*/
+static void ips4o_prepare(IPS4O_SHARED *sh) {
+	const size_t es = sh->es, block = sh->block;
+	size_t full = 0;
+
+	sh->bucket_start[0] = 0;
+	for (int b = 0; b < sh->buckets; b++) {
+		size_t count = 0;
+
+		for (int t = 0; t < sh->threads; t++) {
+			count += sh->local[t].counts[b];
+		}
+		sh->bucket_start[b + 1] = sh->bucket_start[b] + count;
+	}
+
+	for (int t = 0; t < sh->threads; t++) {
+		full += sh->local[t].full;
+	}
+
+	/* fill the empty blocks below `full` from the full blocks above it */
+	int src = sh->threads - 1;
+	size_t src_next = sh->local[src].begin / block + sh->local[src].full;
+	for (int t = 0; t < sh->threads; t++) {
+		size_t e = sh->local[t].begin / block + sh->local[t].full;
+		size_t stripe_end = Min(sh->local[t].end / block, full);
+
+		for (; e < stripe_end; e++) {
+			while (src_next <= Max(sh->local[src].begin / block, full)) {
+				src--;
+				src_next = sh->local[src].begin / block + sh->local[src].full;
+			}
+			src_next--;
+			sort_stats_move(block, es);
+			memcpy(sh->a + e * block * es, sh->a + src_next * block * es, block * es);
+		}
+	}
+
+	for (int b = 0; b <= sh->buckets; b++) {
+		sh->bucket_block[b] = (sh->bucket_start[b] + block - 1) / block;
+	}
+	for (int b = 0; b < sh->buckets; b++) {
+		uint64_t w = sh->bucket_block[b];
+		uint64_t r = Max(Min(full, sh->bucket_block[b + 1]), w);
+
+		atomic_store(&sh->wr[b], w << 32 | r);
+		atomic_store(&sh->pending[b], 0);
+	}
+}
+
+/* take the last unprocessed block of bucket b, if any */
+static bool ips4o_read_block(IPS4O_SHARED *sh, int b, char *dst) {
+	uint64_t wr;
+
+	atomic_fetch_add(&sh->pending[b], 1);
+	wr = atomic_load(&sh->wr[b]);
+	do {
+		if ((uint32_t)wr <= wr >> 32) {
+			atomic_fetch_sub(&sh->pending[b], 1);
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak(&sh->wr[b], &wr, wr - 1));
+
+	sort_stats_move(sh->block, sh->es);
+	memcpy(dst, sh->a + ((uint32_t)wr - 1) * sh->block * sh->es, sh->block * sh->es);
+	atomic_fetch_sub(&sh->pending[b], 1);
+	return true;
+}
+
+/* step 3: move every block to the next free slot of its bucket */
+static void ips4o_permute(IPS4O_SHARED *sh, int tid) {
+	IPS4O_LOCAL *local = &sh->local[tid];
+	const size_t bytes = sh->block * sh->es;
+	char *cur = local->swap[0], *other = local->swap[1];
+
+	for (int s = 0; s < sh->buckets; s++) {
+		int first = (tid * sh->buckets / sh->threads + s) % sh->buckets;
+
+		while (ips4o_read_block(sh, first, cur)) {
+			for (;;) {
+				int b = ips4o_classify(sh, cur);
+				uint64_t wr = atomic_fetch_add(&sh->wr[b], (uint64_t)1 << 32);
+				size_t w = wr >> 32, r = (uint32_t)wr;
+				char *slot = sh->a + w * bytes;
+
+				if (w < r) {
+					/* the slot holds a block still to be placed, carry it on */
+					char *t = cur;
+
+					sort_stats_move(2 * sh->block, sh->es);
+					memcpy(other, slot, bytes);
+					memcpy(slot, cur, bytes);
+					cur = other;
+					other = t;
+					continue;
+				}
+
+				/* an empty slot, possibly still being read by another thread */
+				while (atomic_load(&sh->pending[b]) != 0) {
+					sched_yield();
+				}
+				sort_stats_move(sh->block, sh->es);
+				memcpy((w + 1) * sh->block > sh->n ? sh->overflow : slot, cur, bytes);
+				break;
+			}
+		}
+	}
+}
+
+/*
+* Step 4: complete each bucket, left to right. A bucket's holes are its head
+* in front of its first block and the free slots behind its last one; they
+* are filled with the part of its last block that spills into the next
+* bucket and with the threads' buffers.
+*/
+static void ips4o_cleanup(IPS4O_SHARED *sh) {
+	char *a = sh->a;
+	const size_t es = sh->es, block = sh->block, n = sh->n;
+	const size_t tail = n / block * block;
+	bool overflowed = false;
+
+	for (int b = 0; b < sh->buckets; b++) {
+		if ((atomic_load(&sh->wr[b]) >> 32) * block > n) {
+			overflowed = true;
+		}
+	}
+	if (overflowed) {
+		sort_stats_move(n - tail, es);
+		memcpy(a + tail * es, sh->overflow, (n - tail) * es);
+	}
+
+	for (int b = 0; b < sh->buckets; b++) {
+		size_t start = sh->bucket_start[b], end = sh->bucket_start[b + 1];
+		size_t head = sh->bucket_block[b] * block;
+		size_t blocks_end = (atomic_load(&sh->wr[b]) >> 32) * block;
+		size_t spill = end, spill_end = blocks_end > head ? blocks_end : end;
+		int t = 0;
+		size_t taken = 0;
+
+		for (size_t i = start; i < end; i++) {
+			char *src;
+
+			if (i >= head && i < blocks_end) {
+				i = blocks_end - 1;
+				continue;
+			}
+
+			if (spill < spill_end) {
+				src = spill < n ? a + spill * es : sh->overflow + (spill - tail) * es;
+				spill++;
+			}
+			else {
+				while (taken == sh->local[t].fill[b]) {
+					t++;
+					taken = 0;
+				}
+				src = sh->local[t].buffers + (b * block + taken++) * es;
+			}
+			sort_stats_move(1, es);
+			memcpy(a + i * es, src, es);
+		}
+	}
+}
+
+/* one partitioning level, run by every thread of sh */
+static void ips4o_level(IPS4O_SHARED *sh, int tid) {
+	if (tid == 0) {
+		ips4o_sample(sh);
+	}
+	ips4o_barrier(sh);
+
+	ips4o_classify_stripe(sh, &sh->local[tid]);
+	ips4o_barrier(sh);
+
+	if (tid == 0) {
+		ips4o_prepare(sh);
+	}
+	ips4o_barrier(sh);
+
+	ips4o_permute(sh, tid);
+	ips4o_barrier(sh);
+
+	if (tid == 0) {
+		ips4o_cleanup(sh);
+	}
+	ips4o_barrier(sh);
+}
+
+static void ips4o_shared_init(IPS4O_SHARED *sh, char *a, size_t n, size_t es,
+	int(*cmp) (const void *, const void *), int threads, IPS4O_LOCAL *local) {
+	size_t block = Max(IPS4O_BLOCK_BYTES / es, 1);
+	size_t blocks = n / block;
+
+	sh->a = a;
+	sh->n = n;
+	sh->es = es;
+	sh->cmp = cmp;
+	sh->threads = threads;
+	sh->local = local;
+	sh->block = block;
+	sh->overflow = local[0].overflow;
+	sh->pointer_keys = pointer_keys;
+
+	/* stripes of whole blocks, the last one takes the rest of the range */
+	for (int t = 0; t < threads; t++) {
+		local[t].begin = blocks * t / threads * block;
+		local[t].end = t == threads - 1 ? n : blocks * (t + 1) / threads * block;
+	}
+}
+
+static void ips4o_sequential(char *a, size_t n, size_t es, int(*cmp) (const void *, const void *),
+	IPS4O_LOCAL *local, size_t depth) {
+	IPS4O_SHARED sh;
+
+	if (n <= IPS4O_BASE_CASE_N) {
+		pg_qsort(a, n, es, cmp);
+		return;
+	}
+	// a sample can be made to split off only a few elements per level, so the levels are bounded as in introsort
+	if (!depth) {
+		int swaptype;
+		SWAPINIT(a, es);
+		sort_stats_fallback();
+		heap_sort_fallback(a, n, swaptype, es, cmp);
+		return;
+	}
+
+	ips4o_shared_init(&sh, a, n, es, cmp, 1, local);
+	ips4o_level(&sh, 0);
+
+	for (int b = 0; b < sh.buckets; b++) {
+		if (sh.equal_buckets && b % 2) {
+			continue;
+		}
+		sort_stats_call(ips4o_sequential(a + sh.bucket_start[b] * es, sh.bucket_start[b + 1] - sh.bucket_start[b],
+			es, cmp, local, depth - 1));
+	}
+}
+
+typedef struct {
+	IPS4O_SHARED *sh;
+	int tid;
+} IPS4O_TASK;
+
+static void *ips4o_worker(void *arg) {
+	IPS4O_TASK *task = arg;
+	IPS4O_SHARED *sh = task->sh;
+
+	sort_threads_wait(&sh->go);
+	pointer_keys = sh->pointer_keys;
+	ips4o_level(sh, task->tid);
+
+	/* the threads share out the buckets and sort them one by one */
+	for (;;) {
+		size_t b = atomic_fetch_add(&sh->next_bucket, 1);
+
+		if (b >= (size_t)sh->buckets) {
+			break;
+		}
+		if (sh->equal_buckets && b % 2) {
+			continue;
+		}
+		ips4o_sequential(sh->a + sh->bucket_start[b] * sh->es, sh->bucket_start[b + 1] - sh->bucket_start[b],
+			sh->es, sh->cmp, &sh->local[task->tid], (size_t)(2 * log(sh->n)) - 1);
+	}
+
+	return NULL;
+}
+
+void ips4o_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	const int threads = sort_threads(size, IPS4O_PARALLEL_MIN_N);
+	IPS4O_LOCAL *local;
+
+	if (size <= IPS4O_BASE_CASE_N) {
+		pg_qsort(a, size, es, cmp);
+		return;
+	}
+
+	local = malloc(threads * sizeof(IPS4O_LOCAL));
+	if (local == NULL) {
+		fprintf(stderr, "Error allocating thread state for ips4o sort: need %lu bytes",
+			(unsigned long)(threads * sizeof(IPS4O_LOCAL)));
+		exit(1);
+	}
+	for (int t = 0; t < threads; t++) {
+		ips4o_local_init(&local[t], es);
+	}
+
+	if (threads == 1) {
+		ips4o_sequential(a, size, es, cmp, &local[0], 2 * log(size));
+	}
+	else {
+		IPS4O_SHARED *sh = malloc(sizeof(IPS4O_SHARED));
+		IPS4O_TASK tasks[SORT_MAX_THREADS];
+		pthread_t ids[SORT_MAX_THREADS];
+
+		if (sh == NULL) {
+			fprintf(stderr, "Error allocating shared state for ips4o sort: need %lu bytes",
+				(unsigned long)sizeof(IPS4O_SHARED));
+			exit(1);
+		}
+
+		for (int t = 0; t < threads; t++) {
+			tasks[t].sh = sh;
+			tasks[t].tid = t;
+		}
+		/* the stripes and the barrier are laid out for the threads that started */
+		atomic_store(&sh->go, 0);
+		int started = sort_threads_create(ids, threads, ips4o_worker, tasks, sizeof(tasks[0]));
+
+		ips4o_shared_init(sh, a, size, es, cmp, started, local);
+		pthread_barrier_init(&sh->barrier, NULL, started);
+		atomic_store(&sh->next_bucket, 0);
+		atomic_store(&sh->go, 1);
+
+		ips4o_worker(&tasks[0]);
+		for (int t = 1; t < started; t++) {
+			pthread_join(ids[t], NULL);
+		}
+
+		pthread_barrier_destroy(&sh->barrier);
+		free(sh);
+	}
+
+	for (int t = 0; t < threads; t++) {
+		ips4o_local_free(&local[t]);
+	}
+	free(local);
+}
+
+/*
+* Parallel LSD radix sort for int keys, eight bits per pass.
+*
+* In every pass each thread counts the digits of its slice, the threads
+* turn the counts into one prefix sum (digit major, thread minor, so the
+* pass stays stable) and then scatter their slice to the precomputed
+* offsets. The scatter goes through RADIX_SORT_WC_BYTES of buffer per digit
+* and is the radix_scatter_i32 kernel of sort_dispatch, see simd_radix.h.
+* Passes in which all keys share the digit are skipped.
+*/
+#define RADIX_DIGITS 256
+#define RADIX_PASSES 4
+#define RADIX_LINE 64
+#define RADIX_WC_INTS (RADIX_SORT_WC_BYTES / sizeof(int) > 0 ? RADIX_SORT_WC_BYTES / sizeof(int) : 1)
+#define RADIX_WC_SIZE (RADIX_DIGITS * RADIX_WC_INTS * sizeof(int))
+
+typedef struct {
+	int *src, *dst;
+	size_t n;
+	int threads;
+	size_t (*offsets)[RADIX_DIGITS];	/* per thread: counts, then scatter offsets */
+	bool skip;
+	pthread_barrier_t barrier;
+	atomic_int go;		/* set once the thread count is known */
+} RADIX_SHARED;
+
+typedef struct {
+	RADIX_SHARED *sh;
+	int tid;
+} RADIX_TASK;
+
+/* sign flipped, so the unsigned digits order negative keys first */
+static __inline unsigned radix_digit(int x, int shift) {
+	return ((unsigned)x ^ 0x80000000U) >> shift & (RADIX_DIGITS - 1);
+}
+
+static void radix_barrier(RADIX_SHARED *sh) {
+	if (sh->threads > 1) {
+		pthread_barrier_wait(&sh->barrier);
+	}
+}
+
+static void *radix_worker(void *arg) {
+	RADIX_TASK *task = arg;
+	RADIX_SHARED *sh = task->sh;
+	const int tid = task->tid;
+	size_t lo, hi;
+	size_t *offset = sh->offsets[tid];
+	int *wc = aligned_alloc(RADIX_LINE, (RADIX_WC_SIZE + RADIX_LINE - 1) / RADIX_LINE * RADIX_LINE);
+	int *src = sh->src, *dst = sh->dst;
+
+	if (wc == NULL) {
+		fprintf(stderr, "Error allocating write buffers for radix sort: need %lu bytes",
+			(unsigned long)RADIX_WC_SIZE);
+		exit(1);
+	}
+
+	sort_threads_wait(&sh->go);
+	lo = sh->n * tid / sh->threads;
+	hi = sh->n * (tid + 1) / sh->threads;
+
+	for (int pass = 0; pass < RADIX_PASSES; pass++) {
+		const int shift = pass * 8;
+
+		memset(offset, 0, RADIX_DIGITS * sizeof(size_t));
+		for (size_t i = lo; i < hi; i++) {
+			offset[radix_digit(src[i], shift)]++;
+		}
+		radix_barrier(sh);
+
+		if (tid == 0) {
+			size_t sum = 0;
+
+			sh->skip = false;
+			for (int d = 0; d < RADIX_DIGITS; d++) {
+				size_t count = 0;
+
+				for (int t = 0; t < sh->threads; t++) {
+					size_t c = sh->offsets[t][d];
+
+					sh->offsets[t][d] = sum + count;
+					count += c;
+				}
+				if (count == sh->n) {
+					sh->skip = true;
+				}
+				sum += count;
+			}
+		}
+		radix_barrier(sh);
+
+		if (sh->skip) {
+			continue;
+		}
+
+		sort_stats_move(2 * (hi - lo), sizeof(int));	/* into the buffers and out */
+		sort_kernels()->radix_scatter_i32(src + lo, hi - lo, shift, dst, offset, wc, RADIX_WC_INTS);
+
+		int *t = src;
+		src = dst;
+		dst = t;
+
+		/* nobody may count the next pass before every slice is scattered */
+		radix_barrier(sh);
+	}
+
+	/* the sorted keys end up in whichever buffer the last pass wrote */
+	if (src != sh->src) {
+		sort_stats_move(hi - lo, sizeof(int));
+		memcpy(sh->src + lo, src + lo, (hi - lo) * sizeof(int));
+	}
+
+	free(wc);
+	return NULL;
+}
+
+/* radix sort for int keys ordered by value; other element sizes go to counting_sort */
+void parallel_radix_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	const int threads = sort_threads(size, RADIX_SORT_PARALLEL_MIN_N);
+	RADIX_TASK tasks[SORT_MAX_THREADS];
+	pthread_t ids[SORT_MAX_THREADS];
+	RADIX_SHARED sh;
+
+	if (es != sizeof(int)) {
+		counting_sort(a, size, es, cmp);
+		return;
+	}
+
+	if (size <= 1) {
+		return;
+	}
+
+	sh.src = a;
+	sh.dst = malloc(size * sizeof(int));
+	sh.n = size;
+	sh.offsets = malloc(threads * sizeof(*sh.offsets));
+
+	if (sh.dst == NULL) {
+		fprintf(stderr, "Error allocating temporary storage for radix sort: need %lu bytes",
+			(unsigned long)(size * sizeof(int)));
+		exit(1);
+	}
+	if (sh.offsets == NULL) {
+		fprintf(stderr, "Error allocating digit offsets for radix sort: need %lu bytes",
+			(unsigned long)(threads * sizeof(*sh.offsets)));
+		exit(1);
+	}
+
+	for (int t = 0; t < threads; t++) {
+		tasks[t].sh = &sh;
+		tasks[t].tid = t;
+	}
+	/* the slices and the barrier are laid out for the threads that started */
+	atomic_store(&sh.go, 0);
+	sh.threads = sort_threads_create(ids, threads, radix_worker, tasks, sizeof(tasks[0]));
+	if (sh.threads > 1) {
+		pthread_barrier_init(&sh.barrier, NULL, sh.threads);
+	}
+	atomic_store(&sh.go, 1);
+
+	radix_worker(&tasks[0]);
+	for (int t = 1; t < sh.threads; t++) {
+		pthread_join(ids[t], NULL);
+	}
+	if (sh.threads > 1) {
+		pthread_barrier_destroy(&sh.barrier);
+	}
+
+	free(sh.offsets);
+	free(sh.dst);
+}
+
+/*
+* pg_qsort with a cooperative parallel partition on the top levels, after
+* Tsigas and Zhang, "A Simple, Fast Parallel Implementation of Quicksort and
+* its Performance Evaluation on SUN Enterprise 10000".
+*
+* The threads of a range claim blocks of PG_QSORT_PARALLEL_BLOCK elements
+* from both ends with atomic counters and neutralize a left block against a
+* right one, Hoare style, until one of them holds only elements <= or >=
+* the pivot and is replaced by a new claim. At most one block per thread
+* stays unfinished; the leader moves those next to the unclaimed middle and
+* partitions that span alone. The threads are then shared out between the
+* two sides in proportion to their sizes, and a range left with one thread
+* is sorted by pg_qsort.
+*/
+typedef struct {
+	char *a;
+	size_t n, es;
+	int(*cmp) (const void *, const void *);
+	int swaptype;
+	size_t block;
+	atomic_long remaining;		/* blocks not yet claimed */
+	atomic_size_t left_next, right_next;	/* blocks claimed from either end */
+	size_t left_open[SORT_MAX_THREADS], right_open[SORT_MAX_THREADS];
+	int threads;
+} PG_QSORT_TZ;
+
+typedef struct {
+	PG_QSORT_TZ *tz;
+	int tid;
+} PG_QSORT_TZ_TASK;
+
+#define PG_QSORT_TZ_NONE ((size_t)-1)
+
+/* claim the next block from the left (first element after the pivot) or the right end */
+static bool pg_qsort_tz_claim(PG_QSORT_TZ *tz, bool left, size_t *start) {
+	if (atomic_fetch_sub(&tz->remaining, 1) <= 0) {
+		return false;
+	}
+
+	if (left) {
+		*start = 1 + atomic_fetch_add(&tz->left_next, 1) * tz->block;
+	}
+	else {
+		*start = tz->n - (atomic_fetch_add(&tz->right_next, 1) + 1) * tz->block;
+	}
+	return true;
+}
+
+static void *pg_qsort_tz_worker(void *arg) {
+	PG_QSORT_TZ_TASK *task = arg;
+	PG_QSORT_TZ *tz = task->tz;
+	const size_t es = tz->es, block = tz->block;
+	const int swaptype = tz->swaptype;
+	char *a = tz->a;
+	size_t ls = 0, li = 0, le = 0, rs = 0, rj = 0;
+	bool have_left = false, have_right = false;
+
+	for (;;) {
+		if (!have_left) {
+			if (!pg_qsort_tz_claim(tz, true, &ls)) {
+				break;
+			}
+			li = ls;
+			le = ls + block;
+			have_left = true;
+		}
+		if (!have_right) {
+			if (!pg_qsort_tz_claim(tz, false, &rs)) {
+				break;
+			}
+			rj = rs + block;
+			have_right = true;
+		}
+
+		/* neutralize: elements < pivot stay left, > pivot stay right */
+		for (;;) {
+			while (li < le && tz->cmp(a + li * es, a) < 0) {
+				li++;
+			}
+			while (rj > rs && tz->cmp(a + (rj - 1) * es, a) > 0) {
+				rj--;
+			}
+			if (li == le || rj == rs) {
+				break;
+			}
+			swap(a + li * es, a + (rj - 1) * es);
+			li++;
+			rj--;
+		}
+
+		have_left = li < le;
+		have_right = rj > rs;
+	}
+
+	tz->left_open[task->tid] = have_left ? (ls - 1) / block : PG_QSORT_TZ_NONE;
+	tz->right_open[task->tid] = have_right ? (tz->n - rs) / block - 1 : PG_QSORT_TZ_NONE;
+	return NULL;
+}
+
+/*
+* Swap the unfinished blocks among the `claimed` ones of one end so they
+* occupy the block numbers closest to the middle. Left block k starts at
+* 1 + k * block, right block k ends at n - k * block.
+*/
+static size_t pg_qsort_tz_gather(PG_QSORT_TZ *tz, const size_t *open, size_t claimed, bool left) {
+	const size_t es = tz->es, bytes = tz->block * es;
+	const int swaptype = tz->swaptype;
+	size_t sorted[SORT_MAX_THREADS], count = 0;
+
+	for (int t = 0; t < tz->threads; t++) {
+		if (open[t] != PG_QSORT_TZ_NONE) {
+			size_t i = count++;
+
+			for (; i > 0 && sorted[i - 1] > open[t]; i--) {
+				sorted[i] = sorted[i - 1];
+			}
+			sorted[i] = open[t];
+		}
+	}
+
+	size_t first = claimed - count, slot = first, k = 0;
+	while (k < count && sorted[k] < first) {
+		k++;
+	}
+	for (size_t i = 0; i < count && sorted[i] < first; i++) {
+		/* skip slots near the middle that are unfinished already */
+		while (k < count && sorted[k] == slot) {
+			k++;
+			slot++;
+		}
+		char *p = left ? tz->a + (1 + sorted[i] * tz->block) * es : tz->a + (tz->n - (sorted[i] + 1) * tz->block) * es;
+		char *q = left ? tz->a + (1 + slot * tz->block) * es : tz->a + (tz->n - (slot + 1) * tz->block) * es;
+
+		swapfunc(p, q, bytes, swaptype);
+		slot++;
+	}
+
+	return count;
+}
+
+/* partition a[1..n) around the pivot a[0]; returns mid with a[1..mid) <= pivot <= a[mid..n) */
+static size_t pg_qsort_tz_partition(PG_QSORT_TZ *tz) {
+	const size_t es = tz->es, n = tz->n;
+	const int swaptype = tz->swaptype;
+	char *a = tz->a;
+	PG_QSORT_TZ_TASK tasks[SORT_MAX_THREADS];
+	pthread_t ids[SORT_MAX_THREADS];
+
+	atomic_store(&tz->remaining, (long)((n - 1) / tz->block));
+	atomic_store(&tz->left_next, 0);
+	atomic_store(&tz->right_next, 0);
+
+	for (int t = 0; t < tz->threads; t++) {
+		tasks[t].tz = tz;
+		tasks[t].tid = t;
+	}
+	/* blocks are claimed as the threads go, so the ones that started share all of them */
+	tz->threads = sort_threads_create(ids, tz->threads, pg_qsort_tz_worker, tasks, sizeof(tasks[0]));
+	pg_qsort_tz_worker(&tasks[0]);
+	for (int t = 1; t < tz->threads; t++) {
+		pthread_join(ids[t], NULL);
+	}
+
+	size_t left = atomic_load(&tz->left_next), right = atomic_load(&tz->right_next);
+	size_t i = 1 + (left - pg_qsort_tz_gather(tz, tz->left_open, left, true)) * tz->block;
+	size_t j = n - (right - pg_qsort_tz_gather(tz, tz->right_open, right, false)) * tz->block;
+
+	/* the unfinished blocks and the unclaimed middle, sequentially */
+	if (i < j) {
+		j--;
+		for (;;) {
+			while (i <= j && tz->cmp(a + i * es, a) < 0) {
+				i++;
+			}
+			while (i <= j && tz->cmp(a + j * es, a) > 0) {
+				j--;
+			}
+			if (i > j) {
+				break;
+			}
+			swap(a + i * es, a + j * es);
+			i++;
+			j--;
+		}
+	}
+
+	return i;
+}
+
+typedef struct {
+	char *a;
+	size_t n, es;
+	int(*cmp) (const void *, const void *);
+	int threads;
+	bool pointer_keys;	/* the caller's sort_pointer_keys */
+} PG_QSORT_PARALLEL_TASK;
+
+static void *pg_qsort_parallel_recursive(void *arg) {
+	PG_QSORT_PARALLEL_TASK *task = arg;
+	char *a = task->a;
+	const size_t n = task->n, es = task->es;
+	int swaptype;
+	PG_QSORT_TZ tz;
+
+	pointer_keys = task->pointer_keys;
+	if (task->threads <= 1 || n < PG_QSORT_PARALLEL_MIN_N) {
+		pg_qsort(a, n, es, task->cmp);
+		return NULL;
+	}
+
+	SWAPINIT(a, es);
+
+	/* ninther, as in pg_qsort_recursive */
+	size_t d = (n / 8) * es;
+	char *pl = med3(a, a + d, a + 2 * d, task->cmp);
+	char *pm = med3(a + (n / 2) * es - d, a + (n / 2) * es, a + (n / 2) * es + d, task->cmp);
+	char *pn = med3(a + (n - 1) * es - 2 * d, a + (n - 1) * es - d, a + (n - 1) * es, task->cmp);
+	pm = med3(pl, pm, pn, task->cmp);
+	swap(a, pm);
+
+	tz.a = a;
+	tz.n = n;
+	tz.es = es;
+	tz.cmp = task->cmp;
+	tz.swaptype = swaptype;
+	tz.block = PG_QSORT_PARALLEL_BLOCK;
+	tz.threads = task->threads;
+
+	size_t mid = pg_qsort_tz_partition(&tz);
+	swap(a, a + (mid - 1) * es);
+
+	/* pivot at mid - 1; share the threads out in proportion to the sides */
+	PG_QSORT_PARALLEL_TASK left = *task, right = *task;
+	int threads_left = (int)((task->threads * (mid - 1) + n / 2) / n);
+
+	left.n = mid - 1;
+	left.threads = Max(Min(threads_left, task->threads - 1), 1);
+	right.a = a + mid * es;
+	right.n = n - mid;
+	right.threads = task->threads - left.threads;
+
+	/*
+	* A thread of its own only pays for a right side that is partitioned in
+	* parallel or big enough to overlap with the left; otherwise, or when no
+	* thread can be created, it is sorted here after the left side.
+	*/
+	pthread_t id;
+	bool spawned = (right.threads > 1 || right.n >= PG_QSORT_PARALLEL_MIN_N) &&
+		pthread_create(&id, NULL, pg_qsort_parallel_recursive, &right) == 0;
+
+	sort_stats_call(pg_qsort_parallel_recursive(&left));
+	if (spawned) {
+		pthread_join(id, NULL);
+	}
+	else {
+		sort_stats_call(pg_qsort_parallel_recursive(&right));
+	}
+
+	return NULL;
+}
+
+void parallel_pg_qsort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	PG_QSORT_PARALLEL_TASK task;
+
+	task.a = a;
+	task.n = size;
+	task.es = es;
+	task.cmp = cmp;
+	task.threads = sort_threads(size, PG_QSORT_PARALLEL_MIN_N);
+	task.pointer_keys = pointer_keys;
+	pg_qsort_parallel_recursive(&task);
+}
+
+/*
+* Cache-aware tiled sort. Tiles of half the last level cache are copied to a
+* buffer and sorted by pg_qsort while they are cache resident, where its
+* deeper partitions fit L2 and then L1, and a loser tree merges all tiles
+* back into a in a single pass. Large inputs stream through memory
+* about twice, where pg_qsort streams the whole range once per partitioning
+* level above the cache size.
+*/
+tiled_sort_hook_type tiled_sort_hook = NULL;
+
+typedef struct {
+	char **cur;			/* head of every tile, padding tiles are empty */
+	char **end;
+	int *tree;			/* tree[0] is the winner, tree[1..k) the losers */
+	size_t k;			/* number of leaves, a power of 2 */
+	size_t es;
+	unsigned long long moved;	/* bytes written to the output */
+	int(*cmp) (const void *, const void *);
+} TILED_SORT_MERGE;
+
+static size_t tiled_sort_cache_bytes(void) {
+	long bytes = TILED_SORT_CACHE_BYTES;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	if (bytes <= 0) {
+		bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	}
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+	if (bytes <= 0) {
+		bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	}
+#endif
+	/* not reported by every system */
+	if (bytes <= 0) {
+		bytes = 1 << 20;
+	}
+
+	return (size_t)bytes;
+}
+
+/* does the head of tile i go before the head of tile j; exhausted tiles go last */
+static __inline bool tiled_sort_before(const TILED_SORT_MERGE *m, int i, int j) {
+	int r;
+
+	if (m->cur[i] == m->end[i]) {
+		return false;
+	}
+	if (m->cur[j] == m->end[j]) {
+		return true;
+	}
+
+	r = m->cmp(m->cur[i], m->cur[j]);
+	return r < 0 || (r == 0 && i < j);
+}
+
+/* play the matches below node, leaving the losers in the tree; returns the winner */
+static int tiled_sort_build(TILED_SORT_MERGE *m, size_t node) {
+	int l, r;
+
+	if (node >= m->k) {
+		return (int)(node - m->k);
+	}
+
+	l = tiled_sort_build(m, 2 * node);
+	r = tiled_sort_build(m, 2 * node + 1);
+
+	if (tiled_sort_before(m, l, r)) {
+		m->tree[node] = r;
+		return l;
+	}
+
+	m->tree[node] = l;
+	return r;
+}
+
+static void tiled_sort_merge(TILED_SORT_MERGE *m, char *out, size_t n) {
+	char *end = out + n * m->es;
+
+	m->tree[0] = tiled_sort_build(m, 1);
+
+	for (; out < end; out += m->es) {
+		int w = m->tree[0];
+		size_t node;
+
+		assign(out, m->cur[w], m->es);
+		m->cur[w] += m->es;
+		m->moved += m->es;
+
+		/* replay the matches on the path of the winner's tile */
+		for (node = (w + m->k) >> 1; node > 0; node >>= 1) {
+			if (tiled_sort_before(m, m->tree[node], w)) {
+				int loser = m->tree[node];
+				m->tree[node] = w;
+				w = loser;
+			}
+		}
+
+		m->tree[0] = w;
+	}
+}
+
+void tiled_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *)) {
+	TILED_SORT_STATS stats;
+	TILED_SORT_MERGE m;
+	char *buf;
+	size_t t;
+	double start;
+
+	stats.n = size;
+	stats.es = es;
+	stats.tile_n = Max(tiled_sort_cache_bytes() / 2 / es, 1);
+	stats.tiles = 1;
+	stats.bytes_moved = 0;
+	stats.tile_ns = 0;
+	stats.merge_ns = 0;
+
+	if (size <= stats.tile_n) {
+		pg_qsort(a, size, es, cmp);
+	}
+	else {
+		stats.tiles = (size + stats.tile_n - 1) / stats.tile_n;
+
+		for (m.k = 1; m.k < stats.tiles; m.k <<= 1)
+			;
+
+		buf = (char *)malloc(size * es);
+		m.cur = (char **)malloc(m.k * sizeof(char *));
+		m.end = (char **)malloc(m.k * sizeof(char *));
+		m.tree = (int *)malloc(m.k * sizeof(int));
+
+		if (buf == NULL || m.cur == NULL || m.end == NULL || m.tree == NULL) {
+			fprintf(stderr, "Error allocating temporary storage for tiled sort: need %lu bytes",
+				(unsigned long)(size * es + m.k * (2 * sizeof(char *) + sizeof(int))));
+			exit(1);
+		}
+
+		m.es = es;
+		m.cmp = cmp;
+		m.moved = 0;
+
+		/* pass 1: copy every tile to the buffer and sort it there */
+		start = now_ns();
+
+		for (t = 0; t < m.k; t++) {
+			const size_t lo = Min(t * stats.tile_n, size);
+			const size_t len = Min(stats.tile_n, size - lo);
+
+			m.cur[t] = buf + lo * es;
+			m.end[t] = m.cur[t] + len * es;
+			sort_stats_move(len, es);
+			memcpy(m.cur[t], (char *)a + lo * es, len * es);
+			stats.bytes_moved += len * es;
+			pg_qsort(m.cur[t], len, es, cmp);
+		}
+
+		stats.tile_ns = now_ns() - start;
+
+		/* pass 2: merge the tiles back into a */
+		start = now_ns();
+		tiled_sort_merge(&m, (char *)a, size);
+		stats.merge_ns = now_ns() - start;
+		stats.bytes_moved += m.moved;
+
+		free(buf);
+		free(m.cur);
+		free(m.end);
+		free(m.tree);
+	}
+
+	if (tiled_sort_hook != NULL) {
+		tiled_sort_hook(&stats);
+	}
+}
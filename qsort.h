@@ -1,3 +1,7 @@
+#include <stdbool.h>
+#include <time.h>
+
+/* widest element, in bytes, the engines keep in stack buffers; wider ones get scratch space from malloc */
 #ifndef MAX_ES
 #define MAX_ES 16
 #endif
@@ -18,6 +22,106 @@
 #define RADIX_SORT_BASE 16
 #endif
 
+/* histogram size (in bytes) up to which counting sort is preferred over radix sort */
+#ifndef COUNTING_SORT_BUDGET
+#define COUNTING_SORT_BUDGET (1U << 22)
+#endif
+
+/* arity of the heap used as the introsort fallback, 2 or 4 */
+#ifndef HEAP_SORT_ARITY
+#define HEAP_SORT_ARITY 2
+#endif
+
+/* pg_qsort and tim_sort prefetch keys this many elements ahead where sort_pointer_keys is set, 0 for none */
+#ifndef SORT_PREFETCH_DISTANCE
+#define SORT_PREFETCH_DISTANCE 0
+#endif
+
+/* pg_qsort reverses the descending runs of inputs with at most this many runs, pg_qsort_merge_runs merges them */
+#ifndef PG_QSORT_MAX_RUNS
+#define PG_QSORT_MAX_RUNS 128
+#endif
+
+/* from this range size on pg_qsort_sampled takes the median of about sqrt(n) elements as pivot */
+#ifndef PG_QSORT_SAMPLE_MIN_N
+#define PG_QSORT_SAMPLE_MIN_N 16384
+#endif
+
+/* pg_qsort_repair gives up when more than 1/PG_QSORT_REPAIR_FRACTION of the input is out of order */
+#ifndef PG_QSORT_REPAIR_FRACTION
+#define PG_QSORT_REPAIR_FRACTION 16
+#endif
+
+/* number of evenly spaced elements pg_sort_auto inspects before choosing an engine */
+#ifndef PG_SORT_AUTO_SAMPLE
+#define PG_SORT_AUTO_SAMPLE 32
+#endif
+
+/* pg_sort_auto counts int keys when at least this fraction of its sample repeats */
+#ifndef PG_SORT_AUTO_DUPLICATES
+#define PG_SORT_AUTO_DUPLICATES 0.25
+#endif
+
+/* below this size pg_sort_auto does not sample and always uses pg_qsort */
+#ifndef PG_SORT_AUTO_MIN_N
+#define PG_SORT_AUTO_MIN_N 1024
+#endif
+
+/* threads used by the parallel engines, 0 for one per online CPU */
+#ifndef SORT_THREADS
+#define SORT_THREADS 0
+#endif
+
+#ifndef SORT_MAX_THREADS
+#define SORT_MAX_THREADS 64
+#endif
+
+/* parallel_pg_qsort partitions ranges of at least this many elements with several threads */
+#ifndef PG_QSORT_PARALLEL_MIN_N
+#define PG_QSORT_PARALLEL_MIN_N (1 << 16)
+#endif
+
+/* elements per block claimed by a thread in the parallel partition of parallel_pg_qsort */
+#ifndef PG_QSORT_PARALLEL_BLOCK
+#define PG_QSORT_PARALLEL_BLOCK 4096
+#endif
+
+/* ips4o_sort splits each range into at most 2^IPS4O_LOG_BUCKETS buckets */
+#ifndef IPS4O_LOG_BUCKETS
+#define IPS4O_LOG_BUCKETS 8
+#endif
+#define IPS4O_MAX_BUCKETS (1 << IPS4O_LOG_BUCKETS)
+
+/* ips4o_sort moves elements between buckets in blocks of about this many bytes */
+#ifndef IPS4O_BLOCK_BYTES
+#define IPS4O_BLOCK_BYTES 2048
+#endif
+
+/* ips4o_sort hands ranges of at most this many elements to pg_qsort */
+#ifndef IPS4O_BASE_CASE_N
+#define IPS4O_BASE_CASE_N 4096
+#endif
+
+/* below this size ips4o_sort runs in the calling thread only */
+#ifndef IPS4O_PARALLEL_MIN_N
+#define IPS4O_PARALLEL_MIN_N (1 << 18)
+#endif
+
+/* parallel_radix_sort moves keys through buffers of this many bytes per digit and thread */
+#ifndef RADIX_SORT_WC_BYTES
+#define RADIX_SORT_WC_BYTES 64
+#endif
+
+/* below this size parallel_radix_sort runs in the calling thread only */
+#ifndef RADIX_SORT_PARALLEL_MIN_N
+#define RADIX_SORT_PARALLEL_MIN_N (1 << 16)
+#endif
+
+/* cache size tiled_sort sizes its tiles from, 0 for the detected L3 size (L2 without one) */
+#ifndef TILED_SORT_CACHE_BYTES
+#define TILED_SORT_CACHE_BYTES 0
+#endif
+
 #ifndef CLZ
 #ifdef __GNUC__
 #define CLZ __builtin_clzll
@@ -73,12 +177,88 @@ static int clzll(uint64_t x) {
 #endif
 #endif
 
+/*
+* With SORT_STATS defined the engines count their work in sort_stats, which
+* sort_stats_reset clears; without it the counting compiles to nothing.
+*/
+#ifdef SORT_STATS
+#include <stdatomic.h>
+
+typedef struct {
+	atomic_ullong swaps;		/* elements exchanged with another element */
+	atomic_ullong moves;		/* elements copied, outside of swaps */
+	atomic_ullong bytes_moved;	/* bytes written by swaps and moves */
+	atomic_ullong max_depth;	/* deepest nesting of recursive calls within one thread */
+	atomic_ullong heap_fallbacks;	/* ranges handed to heap sort at the depth limit */
+} SORT_STATS_T;
+
+extern SORT_STATS_T sort_stats;
+
+void sort_stats_reset(void);
+#endif
+
+/* monotonic time in nanoseconds */
+double now_ns(void);
+
+/* whether the elements the calling thread sorts next are pointers to their keys, see SORT_PREFETCH_DISTANCE */
+void sort_pointer_keys(bool on);
+
 void heap_sort_wrapper(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
+void heap_sort4_wrapper(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
 void quick_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
 void dual_pivot_quick_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
 void pg_qsort(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
 void tim_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
+void tim_sort_int(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
 void radix_sort(int *dst, const size_t size);
+void counting_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
 void old_pg_qsort(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
 void rand_pg_qsort(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
 void pg_qsort_once(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
+void pg_qsort_sampled(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
+void pg_qsort_merge_runs(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
+void pg_qsort_repair(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
+void pg_qsort_indirect(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
+void parallel_pg_qsort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
+void ips4o_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
+void parallel_radix_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
+void tiled_sort(void *a, const size_t size, const size_t es, int(*cmp) (const void *, const void *));
+
+/* what tiled_sort did with its last input */
+typedef struct {
+	size_t n;
+	size_t es;
+	size_t tile_n;			/* elements per tile */
+	size_t tiles;			/* 1 if the input fit one tile and was sorted in place */
+	unsigned long long bytes_moved;	/* bytes written by the tile copies and the merge */
+	double tile_ns;			/* time spent copying and sorting the tiles */
+	double merge_ns;		/* time spent in the multiway merge */
+} TILED_SORT_STATS;
+
+typedef void(*tiled_sort_hook_type) (const TILED_SORT_STATS *stats);
+
+/* if set, called with the statistics of every tiled_sort call */
+extern tiled_sort_hook_type tiled_sort_hook;
+
+/* what the caller knows about the keys handed to pg_sort_auto */
+typedef enum { SORT_KEY_OPAQUE, SORT_KEY_INT } SORT_KEY_KIND;
+
+/* sample statistics of a pg_sort_auto call and the engine that sorted its input */
+typedef struct {
+	size_t n;
+	size_t es;
+	SORT_KEY_KIND key;
+	size_t sample;		/* number of sampled elements, 0 if sampling was skipped */
+	double descents;	/* fraction of sampled neighbour pairs that are out of order */
+	double inversions;	/* fraction of inverted pairs among the sampled elements */
+	double duplicates;	/* fraction of sampled elements equal to another sampled element */
+	const char *engine;
+} PG_SORT_AUTO_STATS;
+
+typedef void(*pg_sort_auto_hook_type) (const PG_SORT_AUTO_STATS *stats);
+
+/* if set, called with the statistics of every pg_sort_auto call once it has sorted */
+extern pg_sort_auto_hook_type pg_sort_auto_hook;
+
+void pg_sort_auto(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
+void pg_sort_auto_int(void *a, size_t n, size_t es, int(*cmp) (const void *, const void *));
@@ -0,0 +1,266 @@
+#pragma once
+/*
+* Merge of two sorted runs of plain signed integers with a bitonic merge
+* network on vector registers.
+*
+* Both runs are loaded W elements at a time. The network merges the pending
+* vector with the next one into the W smallest elements, which are stored,
+* and the W largest, which stay pending. The next vector comes from the run
+* whose head is smaller, so no element can be overtaken by a later one. When
+* that run has fewer than W elements left, they are merged with the pending
+* vector into a small buffer that takes the run's place; when either run is
+* shorter than W the rest is merged with the scalar loop.
+*
+* Equal keys are not kept in run order, which cannot be observed for plain
+* integers. Writes never pass the unread part of either run, so one run may
+* share memory with the output as in tim sort: the forward merge may read b
+* from just behind the output, the backward merge may read a from its start.
+*
+*   simd_merge_i32/i64          merge a and b into out, front to back
+*   simd_merge_i32/i64_backward merge a and b into the na + nb elements in
+*                               front of out_end, back to front
+*
+* The kernels are chosen by the flags of the including file: AVX2 merges 8
+* int32 or 4 int64 per step, SSE4.1 4 int32; everything else uses the scalar
+* loop. The simd_merge_*.c files build one variant each, sort_dispatch picks
+* one at run time.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+/* scalar merges, also used for the tails */
+#define SIMD_MERGE_SCALAR(NAME, TYPE) \
+static __inline void NAME(const TYPE *a, size_t na, const TYPE *b, size_t nb, TYPE *out) { \
+	while (na && nb) { \
+		if (*a <= *b) { \
+			*out++ = *a++; \
+			na--; \
+		} \
+		else { \
+			*out++ = *b++; \
+			nb--; \
+		} \
+	} \
+	while (na--) { \
+		*out++ = *a++; \
+	} \
+	while (nb--) { \
+		*out++ = *b++; \
+	} \
+} \
+static __inline void NAME##_backward(const TYPE *a, size_t na, const TYPE *b, size_t nb, TYPE *out_end) { \
+	while (na && nb) { \
+		if (a[na - 1] > b[nb - 1]) { \
+			*--out_end = a[--na]; \
+		} \
+		else { \
+			*--out_end = b[--nb]; \
+		} \
+	} \
+	while (na) { \
+		*--out_end = a[--na]; \
+	} \
+	while (nb) { \
+		*--out_end = b[--nb]; \
+	} \
+}
+
+/*
+* Vector merges around KERNEL(&lo, &hi), which turns two sorted vectors into
+* the sorted lower and upper halves of their union.
+*/
+#define SIMD_MERGE_VECTOR(NAME, SCALAR, TYPE, W, VEC, LOAD, STORE, KERNEL) \
+static __inline void NAME(const TYPE *a, size_t na, const TYPE *b, size_t nb, TYPE *out) { \
+	TYPE pending[W], fold[2][2 * W]; \
+	int f = 0; \
+	while (na >= W && nb >= W) { \
+		VEC lo = LOAD(a), hi = LOAD(b); \
+		const TYPE **x; \
+		size_t *nx; \
+		a += W; \
+		na -= W; \
+		b += W; \
+		nb -= W; \
+		for (;;) { \
+			KERNEL(&lo, &hi); \
+			STORE(out, lo); \
+			out += W; \
+			if (na && (!nb || *a <= *b)) { \
+				x = &a; \
+				nx = &na; \
+			} \
+			else { \
+				x = &b; \
+				nx = &nb; \
+			} \
+			if (*nx < W) { \
+				break; \
+			} \
+			lo = LOAD(*x); \
+			*x += W; \
+			*nx -= W; \
+		} \
+		/* the run to load from next is short: fold it into the pending vector */ \
+		STORE(pending, hi); \
+		SCALAR(pending, W, *x, *nx, fold[f]); \
+		if (x == &a) { \
+			a = fold[f]; \
+			na += W; \
+		} \
+		else { \
+			b = fold[f]; \
+			nb += W; \
+		} \
+		f ^= 1; \
+	} \
+	SCALAR(a, na, b, nb, out); \
+} \
+static __inline void NAME##_backward(const TYPE *a, size_t na, const TYPE *b, size_t nb, TYPE *out_end) { \
+	TYPE pending[W], fold[2][2 * W]; \
+	int f = 0; \
+	while (na >= W && nb >= W) { \
+		VEC lo = LOAD(a + na - W), hi = LOAD(b + nb - W); \
+		const TYPE **x; \
+		size_t *nx; \
+		na -= W; \
+		nb -= W; \
+		for (;;) { \
+			KERNEL(&lo, &hi); \
+			out_end -= W; \
+			STORE(out_end, hi); \
+			if (na && (!nb || a[na - 1] > b[nb - 1])) { \
+				x = &a; \
+				nx = &na; \
+			} \
+			else { \
+				x = &b; \
+				nx = &nb; \
+			} \
+			if (*nx < W) { \
+				break; \
+			} \
+			*nx -= W; \
+			hi = LOAD(*x + *nx); \
+		} \
+		STORE(pending, lo); \
+		SCALAR(pending, W, *x, *nx, fold[f]); \
+		if (x == &a) { \
+			a = fold[f]; \
+			na += W; \
+		} \
+		else { \
+			b = fold[f]; \
+			nb += W; \
+		} \
+		f ^= 1; \
+	} \
+	SCALAR##_backward(a, na, b, nb, out_end); \
+}
+
+SIMD_MERGE_SCALAR(simd_merge_i32_scalar, int32_t)
+SIMD_MERGE_SCALAR(simd_merge_i64_scalar, int64_t)
+
+#if defined(__AVX2__)
+
+#define SIMD_LOAD_256(p) _mm256_loadu_si256((const __m256i *)(p))
+#define SIMD_STORE_256(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+
+/* one compare-exchange stage: lanes in mask take the max */
+#define SIMD_STAGE_I32(v, p, mask) do { \
+	__m256i mn_ = _mm256_min_epi32((v), (p)); \
+	__m256i mx_ = _mm256_max_epi32((v), (p)); \
+	(v) = _mm256_blend_epi32(mn_, mx_, (mask)); \
+} while (0)
+
+static __inline __m256i simd_bitonic8_i32(__m256i v) {
+	SIMD_STAGE_I32(v, _mm256_permute2x128_si256(v, v, 0x01), 0xF0);
+	SIMD_STAGE_I32(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)), 0xCC);
+	SIMD_STAGE_I32(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), 0xAA);
+	return v;
+}
+
+static __inline void simd_merge_kernel_i32(__m256i *lo, __m256i *hi) {
+	__m256i r = _mm256_permutevar8x32_epi32(*hi, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+	__m256i l = _mm256_min_epi32(*lo, r);
+	__m256i h = _mm256_max_epi32(*lo, r);
+
+	*lo = simd_bitonic8_i32(l);
+	*hi = simd_bitonic8_i32(h);
+}
+
+/* there is no 64 bit min/max before AVX-512, compare and blend instead */
+#define SIMD_STAGE_I64(v, p, mask) do { \
+	__m256i p_ = (p); \
+	__m256i gt_ = _mm256_cmpgt_epi64((v), p_); \
+	__m256i mn_ = _mm256_blendv_epi8((v), p_, gt_); \
+	__m256i mx_ = _mm256_blendv_epi8(p_, (v), gt_); \
+	(v) = _mm256_blend_epi32(mn_, mx_, (mask)); \
+} while (0)
+
+static __inline __m256i simd_bitonic4_i64(__m256i v) {
+	SIMD_STAGE_I64(v, _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2)), 0xF0);
+	SIMD_STAGE_I64(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)), 0xCC);
+	return v;
+}
+
+static __inline void simd_merge_kernel_i64(__m256i *lo, __m256i *hi) {
+	__m256i r = _mm256_permute4x64_epi64(*hi, _MM_SHUFFLE(0, 1, 2, 3));
+	__m256i gt = _mm256_cmpgt_epi64(*lo, r);
+	__m256i l = _mm256_blendv_epi8(*lo, r, gt);
+	__m256i h = _mm256_blendv_epi8(r, *lo, gt);
+
+	*lo = simd_bitonic4_i64(l);
+	*hi = simd_bitonic4_i64(h);
+}
+
+SIMD_MERGE_VECTOR(simd_merge_i32, simd_merge_i32_scalar, int32_t, 8, __m256i,
+	SIMD_LOAD_256, SIMD_STORE_256, simd_merge_kernel_i32)
+SIMD_MERGE_VECTOR(simd_merge_i64, simd_merge_i64_scalar, int64_t, 4, __m256i,
+	SIMD_LOAD_256, SIMD_STORE_256, simd_merge_kernel_i64)
+
+#elif defined(__SSE4_1__)
+
+#define SIMD_LOAD_128(p) _mm_loadu_si128((const __m128i *)(p))
+#define SIMD_STORE_128(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+
+#define SIMD_STAGE_I32(v, p, mask) do { \
+	__m128i mn_ = _mm_min_epi32((v), (p)); \
+	__m128i mx_ = _mm_max_epi32((v), (p)); \
+	(v) = _mm_blend_epi16(mn_, mx_, (mask)); \
+} while (0)
+
+static __inline __m128i simd_bitonic4_i32(__m128i v) {
+	SIMD_STAGE_I32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)), 0xF0);
+	SIMD_STAGE_I32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)), 0xCC);
+	return v;
+}
+
+static __inline void simd_merge_kernel_i32(__m128i *lo, __m128i *hi) {
+	__m128i r = _mm_shuffle_epi32(*hi, _MM_SHUFFLE(0, 1, 2, 3));
+	__m128i l = _mm_min_epi32(*lo, r);
+	__m128i h = _mm_max_epi32(*lo, r);
+
+	*lo = simd_bitonic4_i32(l);
+	*hi = simd_bitonic4_i32(h);
+}
+
+SIMD_MERGE_VECTOR(simd_merge_i32, simd_merge_i32_scalar, int32_t, 4, __m128i,
+	SIMD_LOAD_128, SIMD_STORE_128, simd_merge_kernel_i32)
+#define simd_merge_i64 simd_merge_i64_scalar
+#define simd_merge_i64_backward simd_merge_i64_scalar_backward
+
+#else
+
+#define simd_merge_i32 simd_merge_i32_scalar
+#define simd_merge_i32_backward simd_merge_i32_scalar_backward
+#define simd_merge_i64 simd_merge_i64_scalar
+#define simd_merge_i64_backward simd_merge_i64_scalar_backward
+
+#endif
@@ -0,0 +1,18 @@
+/*
+* SSE4.1 build of the merge and radix scatter kernels, the makefile compiles this
+* file with -msse4.1.
+* Nothing else may go here: the whole object may use SSE4.1 instructions and is
+* only entered through the table that sort_dispatch binds on CPUs with SSE4.1.
+*/
+#include "sort_dispatch.h"
+#include "simd_merge.h"
+#include "simd_radix.h"
+
+const SORT_KERNELS sort_kernels_sse41 = {
+	SORT_ISA_SSE41,
+	simd_merge_i32,
+	simd_merge_i32_backward,
+	simd_merge_i64,
+	simd_merge_i64_backward,
+	simd_radix_scatter_i32
+};
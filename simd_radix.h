@@ -0,0 +1,149 @@
+#pragma once
+/*
+* Scatter pass of an LSD radix sort on int32 keys, eight bits per pass.
+*
+* Every key of src goes to dst[offset[d]++], d being the byte at shift of the
+* key with its sign bit flipped, so negative keys order first. The keys of a
+* digit are collected in a write-combining buffer of wc_ints ints (wc holds
+* 256 of them back to back, 64 byte aligned) and flushed as a block, so each
+* store burst hits one destination block instead of up to 256 at a time. The
+* first flush of a digit only fills up to the next block boundary of its
+* destination, so all later flushes write whole aligned blocks.
+*
+*   simd_radix_scatter_i32_scalar  digits one at a time, blocks with memcpy
+*   simd_radix_scatter_i32         the variant of the including file's flags
+*
+* AVX2 and SSE4.1 compute the digits of 8 or 4 keys at once and write the
+* whole blocks with non-temporal stores, which do not read the destination
+* lines into the cache first; that needs wc_ints to be a multiple of the
+* vector width. Everything else uses the scalar kernel. The simd_merge_*.c
+* files build one variant each, sort_dispatch picks one at run time.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+#define SIMD_RADIX_DIGITS 256
+
+static __inline unsigned simd_radix_digit(int32_t x, int shift) {
+	return ((uint32_t)x ^ 0x80000000U) >> shift & (SIMD_RADIX_DIGITS - 1);
+}
+
+/* ints to buffer for a digit before its destination reaches a block boundary */
+static __inline size_t simd_radix_room(const int32_t *dst, size_t wc_ints) {
+	return wc_ints - (size_t)((uintptr_t)dst % (wc_ints * sizeof(int32_t))) / sizeof(int32_t);
+}
+
+/*
+* Scatter loop around DIGITS, which fills d[0..W) with the digits of
+* src[i..i + W), and FLUSH(to, from), which writes one whole aligned block.
+*/
+#define SIMD_RADIX_SCATTER(NAME, W, DIGITS, FLUSH, FENCE) \
+static __inline void NAME(const int32_t *src, size_t n, int shift, int32_t *dst, size_t *offset, \
+	int32_t *wc, size_t wc_ints) { \
+	size_t fill[SIMD_RADIX_DIGITS], room[SIMD_RADIX_DIGITS]; \
+	unsigned d[W]; \
+	size_t i = 0; \
+	int k; \
+	for (k = 0; k < SIMD_RADIX_DIGITS; k++) { \
+		fill[k] = 0; \
+		room[k] = simd_radix_room(dst + offset[k], wc_ints); \
+	} \
+	for (; i < n; i += W) { \
+		const int m = n - i < W ? (int)(n - i) : W; \
+		if (m == W) { \
+			DIGITS(d, src + i, shift); \
+		} \
+		else { \
+			for (k = 0; k < m; k++) { \
+				d[k] = simd_radix_digit(src[i + k], shift); \
+			} \
+		} \
+		for (k = 0; k < m; k++) { \
+			int32_t *buffer = wc + d[k] * wc_ints; \
+			buffer[fill[d[k]]++] = src[i + k]; \
+			if (fill[d[k]] == room[d[k]]) { \
+				if (fill[d[k]] == wc_ints) { \
+					FLUSH(dst + offset[d[k]], buffer); \
+				} \
+				else { \
+					memcpy(dst + offset[d[k]], buffer, fill[d[k]] * sizeof(int32_t)); \
+				} \
+				offset[d[k]] += fill[d[k]]; \
+				fill[d[k]] = 0; \
+				room[d[k]] = wc_ints; \
+			} \
+		} \
+	} \
+	for (k = 0; k < SIMD_RADIX_DIGITS; k++) { \
+		memcpy(dst + offset[k], wc + k * wc_ints, fill[k] * sizeof(int32_t)); \
+		offset[k] += fill[k]; \
+	} \
+	FENCE; \
+}
+
+#define SIMD_RADIX_DIGITS_1(d, p, shift) ((d)[0] = simd_radix_digit(*(p), (shift)))
+#define SIMD_RADIX_FLUSH_COPY(to, from) memcpy((to), (from), wc_ints * sizeof(int32_t))
+
+SIMD_RADIX_SCATTER(simd_radix_scatter_i32_scalar, 1, SIMD_RADIX_DIGITS_1, SIMD_RADIX_FLUSH_COPY, (void)0)
+
+#if defined(__AVX2__)
+
+static __inline void simd_radix_digits_8(unsigned *d, const int32_t *p, int shift) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	v = _mm256_xor_si256(v, _mm256_set1_epi32((int)0x80000000U));
+	v = _mm256_srl_epi32(v, _mm_cvtsi32_si128(shift));
+	v = _mm256_and_si256(v, _mm256_set1_epi32(SIMD_RADIX_DIGITS - 1));
+	_mm256_storeu_si256((__m256i *)d, v);
+}
+
+/* the block is 32 byte aligned whenever wc_ints is a multiple of 8 */
+#define SIMD_RADIX_FLUSH_256(to, from) do { \
+	if (wc_ints % 8 == 0) { \
+		for (size_t j_ = 0; j_ < wc_ints; j_ += 8) { \
+			_mm256_stream_si256((__m256i *)((to) + j_), _mm256_load_si256((const __m256i *)((from) + j_))); \
+		} \
+	} \
+	else { \
+		SIMD_RADIX_FLUSH_COPY(to, from); \
+	} \
+} while (0)
+
+SIMD_RADIX_SCATTER(simd_radix_scatter_i32, 8, simd_radix_digits_8, SIMD_RADIX_FLUSH_256, _mm_sfence())
+
+#elif defined(__SSE4_1__)
+
+static __inline void simd_radix_digits_4(unsigned *d, const int32_t *p, int shift) {
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	v = _mm_xor_si128(v, _mm_set1_epi32((int)0x80000000U));
+	v = _mm_srl_epi32(v, _mm_cvtsi32_si128(shift));
+	v = _mm_and_si128(v, _mm_set1_epi32(SIMD_RADIX_DIGITS - 1));
+	_mm_storeu_si128((__m128i *)d, v);
+}
+
+/* the block is 16 byte aligned whenever wc_ints is a multiple of 4 */
+#define SIMD_RADIX_FLUSH_128(to, from) do { \
+	if (wc_ints % 4 == 0) { \
+		for (size_t j_ = 0; j_ < wc_ints; j_ += 4) { \
+			_mm_stream_si128((__m128i *)((to) + j_), _mm_load_si128((const __m128i *)((from) + j_))); \
+		} \
+	} \
+	else { \
+		SIMD_RADIX_FLUSH_COPY(to, from); \
+	} \
+} while (0)
+
+SIMD_RADIX_SCATTER(simd_radix_scatter_i32, 4, simd_radix_digits_4, SIMD_RADIX_FLUSH_128, _mm_sfence())
+
+#else
+
+#define simd_radix_scatter_i32 simd_radix_scatter_i32_scalar
+
+#endif
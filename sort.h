@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 
 #ifndef SORT_NAME
 #error "Must declare SORT_NAME"
@@ -40,6 +41,14 @@
 #define SORT_SWAP(x,y) {SORT_TYPE __SORT_SWAP_t = (x); (x) = (y); (y) = __SORT_SWAP_t;}
 #endif
 
+/*
+* define SORT_SIMD_MERGE when SORT_TYPE is a signed 32 or 64 bit integer ordered by
+* value, MERGE_SORT then merges with the vector kernels of simd_merge.h
+*/
+#ifdef SORT_SIMD_MERGE
+#include "simd_merge.h"
+#endif
+
 
 /* Common, type-agnostic functions and constants that we don't want to declare twice. */
 #ifndef SORT_COMMON_H
@@ -158,6 +167,8 @@ static __inline size_t rbnd(size_t len) {
 #define DUAL_PIVOT_QUICK_SORT          SORT_MAKE_STR(dual_pivot_quick_sort)
 #define RADIX_SORT                     SORT_MAKE_STR(radix_sort)
 #define MERGE_SORT                     SORT_MAKE_STR(merge_sort)
+#define MERGE_SORT_4WAY                SORT_MAKE_STR(merge_sort_4way)
+#define MERGE_SORT_4WAY_MERGE          SORT_MAKE_STR(merge_sort_4way_merge)
 #define MERGE_SORT_IN_PLACE            SORT_MAKE_STR(merge_sort_in_place)
 #define MERGE_SORT_IN_PLACE_RMERGE     SORT_MAKE_STR(merge_sort_in_place_rmerge)
 #define MERGE_SORT_IN_PLACE_BACKMERGE  SORT_MAKE_STR(merge_sort_in_place_backmerge)
@@ -231,6 +242,7 @@ void HEAP_SORT(SORT_TYPE *dst, const size_t size);
 void QUICK_SORT(SORT_TYPE *dst, const size_t size);
 void INTRO_SORT(SORT_TYPE *dst, const size_t size);
 void MERGE_SORT(SORT_TYPE *dst, const size_t size);
+void MERGE_SORT_4WAY(SORT_TYPE *dst, const size_t size);
 void MERGE_SORT_IN_PLACE(SORT_TYPE *dst, const size_t size);
 void SELECTION_SORT(SORT_TYPE *dst, const size_t size);
 void TIM_SORT(SORT_TYPE *dst, const size_t size);
@@ -616,6 +628,20 @@ void MERGE_SORT(SORT_TYPE *dst, const size_t size) {
 	MERGE_SORT(&dst[middle], size - middle);
 	newdst = (SORT_TYPE *)malloc(size * sizeof(SORT_TYPE));
 
+#ifdef SORT_SIMD_MERGE
+
+	if (sizeof(SORT_TYPE) == sizeof(int32_t)) {
+		simd_merge_i32((const int32_t *)dst, middle, (const int32_t *)&dst[middle], size - middle,
+			(int32_t *)newdst);
+	}
+	else {
+		simd_merge_i64((const int64_t *)dst, middle, (const int64_t *)&dst[middle], size - middle,
+			(int64_t *)newdst);
+	}
+
+	out = size;
+#endif
+
 	while (out != size) {
 		if (i < middle) {
 			if (j < size) {
@@ -641,6 +667,149 @@ void MERGE_SORT(SORT_TYPE *dst, const size_t size) {
 	free(newdst);
 }
 
+/*
+* Stable merge of the k <= 4 sorted runs cur[i]..end[i] into dst.
+* While all k runs have elements, the smallest head is picked by a tournament
+* of comparisons whose results only select pointers and advance cursors, so
+* the compiler emits conditional moves instead of hard to predict branches.
+* Ties go to the run that comes first, which keeps the merge stable. Once a
+* run is exhausted the others continue as a 3-way, then 2-way merge, and the
+* last run is copied.
+*/
+static void MERGE_SORT_4WAY_MERGE(SORT_TYPE *dst, const SORT_TYPE **cur, const SORT_TYPE **end, int k) {
+	while (1) {
+		int i, j;
+
+		/* drop the exhausted runs, keeping the order of the others */
+		for (i = j = 0; i < k; i++) {
+			if (cur[i] != end[i]) {
+				cur[j] = cur[i];
+				end[j++] = end[i];
+			}
+		}
+
+		k = j;
+
+		if (k <= 1) {
+			break;
+		}
+
+		if (k == 4) {
+			const SORT_TYPE *p0 = cur[0], *p1 = cur[1], *p2 = cur[2], *p3 = cur[3];
+			const SORT_TYPE *e0 = end[0], *e1 = end[1], *e2 = end[2], *e3 = end[3];
+
+			while (p0 != e0 && p1 != e1 && p2 != e2 && p3 != e3) {
+				const int c01 = SORT_CMP(*p1, *p0) < 0;
+				const int c23 = SORT_CMP(*p3, *p2) < 0;
+				const SORT_TYPE *a = c01 ? p1 : p0;
+				const SORT_TYPE *b = c23 ? p3 : p2;
+				const int cab = SORT_CMP(*b, *a) < 0;
+				*dst++ = cab ? *b : *a;
+				p0 += (c01 | cab) ^ 1;
+				p1 += c01 & (cab ^ 1);
+				p2 += (c23 ^ 1) & cab;
+				p3 += c23 & cab;
+			}
+
+			cur[0] = p0;
+			cur[1] = p1;
+			cur[2] = p2;
+			cur[3] = p3;
+		}
+		else if (k == 3) {
+			const SORT_TYPE *p0 = cur[0], *p1 = cur[1], *p2 = cur[2];
+			const SORT_TYPE *e0 = end[0], *e1 = end[1], *e2 = end[2];
+
+			while (p0 != e0 && p1 != e1 && p2 != e2) {
+				const int c01 = SORT_CMP(*p1, *p0) < 0;
+				const SORT_TYPE *a = c01 ? p1 : p0;
+				const int c2 = SORT_CMP(*p2, *a) < 0;
+				*dst++ = c2 ? *p2 : *a;
+				p0 += (c01 | c2) ^ 1;
+				p1 += c01 & (c2 ^ 1);
+				p2 += c2;
+			}
+
+			cur[0] = p0;
+			cur[1] = p1;
+			cur[2] = p2;
+		}
+		else {
+			const SORT_TYPE *p0 = cur[0], *p1 = cur[1];
+			const SORT_TYPE *e0 = end[0], *e1 = end[1];
+
+			while (p0 != e0 && p1 != e1) {
+				const int c = SORT_CMP(*p1, *p0) < 0;
+				*dst++ = c ? *p1 : *p0;
+				p0 += c ^ 1;
+				p1 += c;
+			}
+
+			cur[0] = p0;
+			cur[1] = p1;
+		}
+	}
+
+	if (k == 1) {
+		memcpy(dst, cur[0], (size_t)(end[0] - cur[0]) * sizeof(SORT_TYPE));
+	}
+}
+
+/*
+* Bottom-up merge sort that merges four runs at a time, so it needs half the
+* passes over memory of a two way merge. Passes alternate between the input and
+* one buffer of the same size, and the result is copied back at most once.
+*/
+void MERGE_SORT_4WAY(SORT_TYPE *dst, const size_t size) {
+	SORT_TYPE *buf, *src, *out, *tmp;
+	size_t width, i;
+
+	if (size < INSERTION_THRESHOLD) {
+		BINARY_INSERTION_SORT(dst, size);
+		return;
+	}
+
+	buf = (SORT_TYPE *)malloc(size * sizeof(SORT_TYPE));
+
+	if (buf == NULL) {
+		fprintf(stderr, "Error allocating temporary storage for merge sort: need %lu bytes",
+			(unsigned long)(sizeof(SORT_TYPE) * size));
+		exit(1);
+	}
+
+	for (i = 0; i < size; i += INSERTION_THRESHOLD) {
+		BINARY_INSERTION_SORT(&dst[i], MIN(INSERTION_THRESHOLD, size - i));
+	}
+
+	src = dst;
+	out = buf;
+
+	for (width = INSERTION_THRESHOLD; width < size; width *= 4) {
+		for (i = 0; i < size; i += 4 * width) {
+			const SORT_TYPE *cur[4], *end[4];
+			int r;
+
+			for (r = 0; r < 4; r++) {
+				const size_t lo = MIN(i + r * width, size);
+				cur[r] = &src[lo];
+				end[r] = &src[MIN(lo + width, size)];
+			}
+
+			MERGE_SORT_4WAY_MERGE(&out[i], cur, end, 4);
+		}
+
+		tmp = src;
+		src = out;
+		out = tmp;
+	}
+
+	if (src != dst) {
+		memcpy(dst, src, size * sizeof(SORT_TYPE));
+	}
+
+	free(buf);
+}
+
 
 /* Quick sort: based on wikipedia */
 
@@ -801,7 +970,8 @@ void INTRO_SORT(SORT_TYPE *dst, const size_t size) {
 }
 
 /* dualpivot quicksort recursive function */
-static void DUAL_PIVOT_QUICK_SORT_RECURSIVE(SORT_TYPE *dst, const size_t left, const size_t right) {
+static void DUAL_PIVOT_QUICK_SORT_RECURSIVE(SORT_TYPE *dst, size_t left, size_t right, size_t depth_limit) {
+loop:;
 	const size_t length = right - left + 1U;
 
 	// Use insertion sort on tiny arrays
@@ -810,6 +980,13 @@ static void DUAL_PIVOT_QUICK_SORT_RECURSIVE(SORT_TYPE *dst, const size_t left, c
 		return;
 	}
 
+	// convert to heapsort when exceeding depth limit
+	if (!depth_limit) {
+		HEAP_SORT(&dst[left], length);
+		return;
+	}
+	depth_limit--;
+
 	// Inexpensive approximation of length / 7
 	size_t seventh = (length >> 3) + (length >> 6) + 1U;
 
@@ -875,9 +1052,11 @@ static void DUAL_PIVOT_QUICK_SORT_RECURSIVE(SORT_TYPE *dst, const size_t left, c
 
 		/*
 		* Skip elements, which are less or greater than pivot values.
+		* SORT_CMP may evaluate its arguments more than once, so the
+		* index is stepped outside of it.
 		*/
-		while (SORT_CMP(dst[++less], pivot1) < 0);
-		while (SORT_CMP(dst[--great], pivot2) > 0);
+		do { ++less; } while (SORT_CMP(dst[less], pivot1) < 0);
+		do { --great; } while (SORT_CMP(dst[great], pivot2) > 0);
 
 		/*
 		* Partitioning:
@@ -936,9 +1115,12 @@ static void DUAL_PIVOT_QUICK_SORT_RECURSIVE(SORT_TYPE *dst, const size_t left, c
 		dst[left] = dst[less - 1]; dst[less - 1] = pivot1;
 		dst[right] = dst[great + 1]; dst[great + 1] = pivot2;
 
-		// Sort left and right parts recursively, excluding known pivots
-		DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, left, less - 2);
-		DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, great + 2, right);
+		// Left and right parts, excluding known pivots
+		size_t starts[3], sizes[3];
+		starts[0] = left;
+		sizes[0] = less - 1 - left;
+		starts[2] = great + 2;
+		sizes[2] = right - great - 1;
 
 		/*
 		* If center part is too large (comprises > 4/7 of the array),
@@ -1011,9 +1193,24 @@ static void DUAL_PIVOT_QUICK_SORT_RECURSIVE(SORT_TYPE *dst, const size_t left, c
 		jump2:;
 		}
 
-		// Sort center part recursively
-		DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, less, great);
+		starts[1] = less;
+		sizes[1] = great + 1 - less;
 
+		/*
+		* Sort the two smaller parts recursively and iterate on the
+		* largest one, so the stack stays bounded by log(n) frames.
+		*/
+		int largest = sizes[0] >= sizes[1] ? (sizes[0] >= sizes[2] ? 0 : 2) : (sizes[1] >= sizes[2] ? 1 : 2);
+		for (int p = 0; p < 3; p++) {
+			if (p != largest && sizes[p] > 1) {
+				DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, starts[p], starts[p] + sizes[p] - 1, depth_limit);
+			}
+		}
+		if (sizes[largest] > 1) {
+			left = starts[largest];
+			right = starts[largest] + sizes[largest] - 1;
+			goto loop;
+		}
 	}
 	else { // Partitioning with one pivot
 		   /*
@@ -1078,19 +1275,30 @@ static void DUAL_PIVOT_QUICK_SORT_RECURSIVE(SORT_TYPE *dst, const size_t left, c
 		}
 
 		/*
-		* Sort left and right parts recursively.
+		* Sort left and right parts, recursing on the smaller one.
 		* All elements from center part are equal
 		* and, therefore, already sorted.
 		*/
-		DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, left, less - 1);
-		DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, great + 1, right);
+		if (less - left <= right - great) {
+			DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, left, less - 1, depth_limit);
+			left = great + 1;
+		}
+		else {
+			DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, great + 1, right, depth_limit);
+			right = less - 1;
+		}
+		goto loop;
 	}
 }
 
 /* Dual-pivot quicksort implementation, based on JDK8 */
 void DUAL_PIVOT_QUICK_SORT(SORT_TYPE *dst, const size_t size) {
+	/* don't bother sorting an array of size 1 */
+	if (size <= 1) {
+		return;
+	}
 
-	DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, 0U, size - 1U);
+	DUAL_PIVOT_QUICK_SORT_RECURSIVE(dst, 0U, size - 1U, 2 * log(size));
 }
 
 /*
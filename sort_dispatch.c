@@ -0,0 +1,118 @@
+#include "sort_dispatch.h"
+#include "simd_merge.h"
+#include "simd_radix.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+/* scalar reference kernels, whatever flags this file is built with */
+const SORT_KERNELS sort_kernels_scalar = {
+	SORT_ISA_SCALAR,
+	simd_merge_i32_scalar,
+	simd_merge_i32_scalar_backward,
+	simd_merge_i64_scalar,
+	simd_merge_i64_scalar_backward,
+	simd_radix_scatter_i32_scalar
+};
+
+static const SORT_KERNELS *const sort_kernel_table[SORT_ISA_COUNT] = {
+	&sort_kernels_scalar,
+	&sort_kernels_sse41,
+	&sort_kernels_avx2
+};
+
+static const char *const sort_isa_names[SORT_ISA_COUNT] = { "scalar", "sse4.1", "avx2" };
+
+static const SORT_KERNELS *_Atomic bound;
+static pthread_once_t bound_once = PTHREAD_ONCE_INIT;
+
+SORT_ISA sort_isa_detect(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	/* cpuid, and for AVX also whether the OS saves the ymm registers */
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		return SORT_ISA_AVX2;
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		return SORT_ISA_SSE41;
+	}
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4];
+
+	__cpuid(info, 0);
+
+	if (info[0] >= 7) {
+		int leaf1[4];
+
+		__cpuid(leaf1, 1);
+		__cpuidex(info, 7, 0);
+
+		/* OSXSAVE, AVX and AVX2, with xmm and ymm state enabled */
+		if ((leaf1[2] & (1 << 27)) && (leaf1[2] & (1 << 28)) && (info[1] & (1 << 5))
+			&& (_xgetbv(0) & 6) == 6) {
+			return SORT_ISA_AVX2;
+		}
+	}
+
+	__cpuid(info, 1);
+
+	if (info[2] & (1 << 19)) {
+		return SORT_ISA_SSE41;
+	}
+#endif
+
+	return SORT_ISA_SCALAR;
+}
+
+const char *sort_isa_name(SORT_ISA isa) {
+	return isa < SORT_ISA_COUNT ? sort_isa_names[isa] : "unknown";
+}
+
+bool sort_isa_force(SORT_ISA isa) {
+	if (isa >= SORT_ISA_COUNT || isa > sort_isa_detect()) {
+		return false;
+	}
+
+	sort_kernels();
+	bound = sort_kernel_table[isa];
+	return true;
+}
+
+static void sort_kernels_bind(void) {
+	SORT_ISA isa = sort_isa_detect();
+	const char *env = getenv("SORT_ISA");
+
+	if (env != NULL) {
+		SORT_ISA i;
+
+		for (i = SORT_ISA_SCALAR; i < SORT_ISA_COUNT; i++) {
+			if (strcmp(env, sort_isa_names[i]) == 0) {
+				break;
+			}
+		}
+
+		if (i == SORT_ISA_COUNT) {
+			fprintf(stderr, "SORT_ISA=%s is unknown, using %s\n", env, sort_isa_names[isa]);
+		}
+		else if (i > isa) {
+			fprintf(stderr, "SORT_ISA=%s is not supported on this CPU, using %s\n", env, sort_isa_names[isa]);
+		}
+		else {
+			isa = i;
+		}
+	}
+
+	bound = sort_kernel_table[isa];
+}
+
+const SORT_KERNELS *sort_kernels(void) {
+	pthread_once(&bound_once, sort_kernels_bind);
+	return bound;
+}
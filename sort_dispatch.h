@@ -0,0 +1,48 @@
+#pragma once
+/*
+* Run time dispatch of the SIMD sort kernels.
+*
+* Every kernel family has a scalar reference and variants built with wider
+* instruction sets, each in its own object file. The CPU is inspected once,
+* with cpuid, and the best variant it supports is bound; SORT_ISA in the
+* environment (scalar, sse4.1, avx2) or sort_isa_force picks a lower one.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* kernel variants, each one requires the instruction sets of the ones before it */
+typedef enum { SORT_ISA_SCALAR, SORT_ISA_SSE41, SORT_ISA_AVX2, SORT_ISA_COUNT } SORT_ISA;
+
+/* merges of two sorted runs of plain integers, see simd_merge.h */
+typedef void(*sort_merge_i32_type) (const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+typedef void(*sort_merge_i64_type) (const int64_t *a, size_t na, const int64_t *b, size_t nb, int64_t *out);
+
+/* scatter pass of the int radix sort, see simd_radix.h */
+typedef void(*sort_radix_scatter_i32_type) (const int32_t *src, size_t n, int shift, int32_t *dst, size_t *offset,
+	int32_t *wc, size_t wc_ints);
+
+typedef struct {
+	SORT_ISA isa;
+	sort_merge_i32_type merge_i32;
+	sort_merge_i32_type merge_i32_backward;
+	sort_merge_i64_type merge_i64;
+	sort_merge_i64_type merge_i64_backward;
+	sort_radix_scatter_i32_type radix_scatter_i32;
+} SORT_KERNELS;
+
+extern const SORT_KERNELS sort_kernels_scalar;
+extern const SORT_KERNELS sort_kernels_sse41;
+extern const SORT_KERNELS sort_kernels_avx2;
+
+/* the kernels bound for this process */
+const SORT_KERNELS *sort_kernels(void);
+
+/* best variant the CPU supports */
+SORT_ISA sort_isa_detect(void);
+
+/* bind the kernels of isa; false if the CPU does not support it */
+bool sort_isa_force(SORT_ISA isa);
+
+const char *sort_isa_name(SORT_ISA isa);
@@ -0,0 +1,7 @@
+#include "sort_i32.h"
+
+/* sort.h defines every generic sort, most of which are never called here */
+#define SORT_NAME i32
+#define SORT_TYPE int
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "sort.h"
@@ -0,0 +1,8 @@
+#pragma once
+/*
+The generic sorts of sort.h instantiated for int keys in sort_i32.c; only the
+4-way merge sort is benchmarked, so only it is declared here.
+*/
+#include <stddef.h>
+
+void i32_merge_sort_4way(int *dst, const size_t size);
@@ -2,11 +2,84 @@
 #include<string.h>
 #include<stdlib.h>
 #include<time.h>
+#include<limits.h>
 
 #include "benchmark.h"
 
-int main() {
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [--types=LIST] [--patterns=LIST] [--sizes=LIST] [--routines=LIST] [--pages=PAGES] [--param=PATTERN=VALUE] [--seed=N] [--export-text]\n", prog);
+	fprintf(stderr, "LIST is comma separated, everything is run if an option is missing\n");
+	fprintf(stderr, "  types:    names or codes:");
+	for (int i = 0; i < BENCH_TYPES; i++) {
+		fprintf(stderr, " %s(%d)", bench_types[i].name, i);
+	}
+	fprintf(stderr, "\n  patterns: names or numbers:");
+	for (int i = SORTED; i < PATTERNS; i++) {
+		fprintf(stderr, " %s(%d)", pattern_names[i], i);
+	}
+	fprintf(stderr, "\n  sizes:    element counts up to %d, default %d, %d, ... %d\n", INT_MAX, MIN_N, MIN_N * 10, MAX_N);
+	fprintf(stderr, "  routines: parts of routine names, as in result.csv\n");
+	fprintf(stderr, "PAGES backs the arrays with default, small (4 KiB), thp (transparent huge) or hugetlb pages\n");
+	fprintf(stderr, "--param sets the parameter of a pattern, see benchmark.h; defaults:");
+	for (int i = SORTED; i < PATTERNS; i++) {
+		if (pattern_params[i]) {
+			fprintf(stderr, " %s=%g", pattern_names[i], pattern_params[i]);
+		}
+	}
+	fprintf(stderr, "\n--seed seeds the data generator, default %d; cached data of another seed is generated again\n", SEED);
+	fprintf(stderr, "--export-text also writes the cached test data as td_<type>_<pattern>_<n>.txt\n");
+}
+
+int main(int argc, char **argv) {
+	BenchFilter filter = { NULL, NULL, NULL, NULL };
+
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "--types=", 8)) {
+			filter.types = argv[i] + 8;
+		}
+		else if (!strncmp(argv[i], "--patterns=", 11)) {
+			filter.patterns = argv[i] + 11;
+		}
+		else if (!strncmp(argv[i], "--sizes=", 8)) {
+			filter.sizes = argv[i] + 8;
+			if (!checkSizes(filter.sizes)) {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if (!strncmp(argv[i], "--routines=", 11)) {
+			filter.routines = argv[i] + 11;
+		}
+		else if (!strncmp(argv[i], "--param=", 8)) {
+			if (!setPatternParam(argv[i] + 8)) {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if (!strncmp(argv[i], "--seed=", 7)) {
+			bench_seed = strtoull(argv[i] + 7, NULL, 0);
+		}
+		else if (!strcmp(argv[i], "--export-text")) {
+			bench_export_text = true;
+		}
+		else if (!strncmp(argv[i], "--pages=", 8)) {
+			int p = PAGES_DEFAULT;
+			while (p <= PAGES_HUGETLB && strcmp(argv[i] + 8, bench_pages_names[p])) {
+				p++;
+			}
+			if (p > PAGES_HUGETLB) {
+				usage(argv[0]);
+				return 1;
+			}
+			bench_pages = p;
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
 	freopen("result.csv", "w", stdout);
-	test();
+	test(&filter);
 	return 0;
-}
\ No newline at end of file
+}